@@ -0,0 +1,70 @@
+// Raymarched Terrain Camera, Shared Include
+// Date: 19/10/2026
+// Purpose: The raymarcher's camera, and last frame's, along with the projections between them and the screen, and where the fovea sits on it.
+// It's pulled into raymarch.frag and raymarch_resolve.frag with #pragma include, so that the rays a frame is marched along and the ones its history
+// is reprojected along are always the same.
+//
+// The including shader must declare screenResolution, the size of the full-resolution render in pixels.
+
+uniform vec3 cameraPosition = vec3(0,0,-5);
+uniform vec3 cameraUpVector = vec3(0,1,0);
+uniform vec3 cameraLookTarget = vec3(0,0,0);
+
+// The camera that the history was rendered from.
+uniform vec3 previousCameraPosition;
+uniform vec3 previousCameraUpVector;
+uniform vec3 previousCameraLookTarget;
+
+// Field of view scales. .75 is fine for movement?
+const float CameraFovX = 0.75f;
+const float CameraFovY = 0.57f;
+
+// How far a full-resolution pixel position is from the centre of the screen, in screen heights. Foveated rendering marches the pixels within
+// foveaRadius of the centre at full rate; the marching passes and the resolve pass all use this, so that they agree on which pixels those are.
+float FoveaDistance(vec2 pixelPosition)
+{
+	return length((pixelPosition - (screenResolution * 0.5f)) / screenResolution.y);
+}
+
+// Returns the direction of the ray through a pixel, for a camera with the given position and orientation.
+vec3 CameraRay(vec2 pixelPosition, vec3 position, vec3 lookTarget, vec3 upVector, float fovX, float fovY)
+{
+	vec2 screenPosition = pixelPosition / screenResolution;
+
+	screenPosition.y = 1.0f - screenPosition.y;
+	screenPosition.x = 1.0f - screenPosition.x;
+	vec2 screenPositionOffset = -1.0f + 2.0f * screenPosition;
+
+	vec3 cameraDirection = normalize(lookTarget - position);
+	vec3 cameraRight = normalize(cross(upVector, cameraDirection));
+	vec3 cameraLowerBound = cross(cameraDirection, cameraRight);
+	vec3 cameraStep = position + cameraDirection;
+
+	vec3 eyeCoordinate = cameraStep + (screenPositionOffset.x * cameraRight * (screenResolution.x / screenResolution.y) * fovX) + (screenPositionOffset.y * cameraLowerBound * fovY);
+	return normalize(eyeCoordinate - position);
+}
+
+// The reverse of CameraRay for the previous frame's camera: finds the pixel that a world-space position was drawn at.
+// Returns false if the position was behind the camera or off the screen.
+bool ProjectToPreviousScreen(vec3 worldPosition, float fovX, float fovY, out vec2 pixelPosition)
+{
+	vec3 cameraDirection = normalize(previousCameraLookTarget - previousCameraPosition);
+	vec3 cameraRight = normalize(cross(previousCameraUpVector, cameraDirection));
+	vec3 cameraLowerBound = cross(cameraDirection, cameraRight);
+
+	vec3 relativePosition = worldPosition - previousCameraPosition;
+	float depth = dot(relativePosition, cameraDirection);
+	if(depth <= 0.0f)
+	{
+		return false;
+	}
+
+	// Where the position crosses the eye plane, one unit in front of the camera.
+	vec3 planePosition = relativePosition / depth;
+	vec2 screenPositionOffset = vec2(dot(planePosition, cameraRight) / ((screenResolution.x / screenResolution.y) * fovX), dot(planePosition, cameraLowerBound) / fovY);
+	vec2 screenPosition = (screenPositionOffset + 1.0f) * 0.5f;
+
+	pixelPosition = (1.0f - screenPosition) * screenResolution;
+
+	return all(greaterThanEqual(pixelPosition, vec2(0.0f))) && all(lessThan(pixelPosition, screenResolution));
+}
@@ -0,0 +1,130 @@
+// Terrain Density Function, Shared Include
+// Date: 19/10/2026
+// Purpose: This is the one definition of the terrain's density/distance field, along with the primitives and CSG combiners it's built from.
+// It's pulled into render_density.frag and raymarch.frag with #pragma include when they're loaded, so both terrains, and the physics built from the grid, see the same surface.
+// The surface is where the field crosses zero; negative is solid, positive is air.
+// DensityField.cpp mirrors this file on the CPU, and TerrainGridMarchingCubes::CheckDensityParity compares the two. Any change here must be made there too.
+//
+// The including shader must define BoundDistance, which rescales a distance by its Lipschitz bound where the caller steps by it.
+
+uniform samplerBuffer csgtex;
+uniform float numberOfCSG;
+
+// Baked noise volume; see NoiseVolume.
+uniform sampler3D noisevolume;
+uniform float noiseVolumePeriod = 32.0f;
+uniform float noiseVolumeResolution = 128.0f;
+
+// Lipschitz bound of the noise terrain: how fast its density can change per unit of distance. DensityField::TerrainLipschitz holds the same value.
+// The floor (y + 10) changes by 1 per unit, in Y only. Each noise octave is amplitude * noise_g(position * frequency), and the value noise between
+// lattice values in [0, 1] is blended with smoothstep, whose steepest slope is 1.5; so an octave changes by at most 1.5 * frequency * amplitude along
+// each axis. Baking doesn't raise that: trilinear filtering between texels only ever slopes as steeply as the difference between neighbouring texels,
+// which the smoothstep slope already bounds. That gives, per axis:
+//   X, Z: 1.5 * (0.01 * 70) + 1.5 * (0.05 * 10) = 1.05 + 0.75 = 1.8
+//   Y:    1 + 1.8 = 2.8
+// and the gradient can be no longer than sqrt(1.8^2 + 2.8^2 + 1.8^2) ~= 3.78, rounded up to 3.8. The CSG spheres are exact distances, and carry their own bounds.
+uniform float terrainLipschitz = 3.8f;
+
+float BoundDistance(float distance, float lipschitz);
+
+// Noise, baked into a tileable volume by NoiseVolume. x is in lattice cells; one trilinear fetch gives the smoothly interpolated value noise at that point.
+// This must match NoiseVolume::Sample.
+float noise_g(vec3 x)
+{
+	return textureLod(noisevolume, (x / noiseVolumePeriod) + vec3(0.5f / noiseVolumeResolution), 0.0f).r;
+}
+
+// Set of functions for representing distance-fields for shapes.
+// The Y-Coordinate here is used for material/texturing information.
+vec2 ShapeFlatFloor(vec3 worldPosition)
+{
+	return vec2(worldPosition.y + 10.0f, 0.0f);
+}
+
+vec2 CSG_Sphere(vec3 position, float size, vec3 worldPosition)
+{
+	return vec2(length(worldPosition - position) - size, 1.0f);
+}
+
+vec2 CSG_Box(vec3 position, vec3 bounds, vec3 worldPosition)
+{
+	return vec2(length(max(abs(worldPosition - position) - bounds, 0.0f)), 1.0f);
+}
+
+vec2 CSG_RoundBox(vec3 position, vec3 bounds, vec3 worldPosition, float roundness)
+{
+	return vec2(length(max(abs(worldPosition - position) - bounds, 0.0f)) - roundness, 1.0f);
+}
+
+// The CSG functions are simple to calculate;
+// In Union, whichever shape is closer wins.
+vec2 CSG_Union(vec2 density1, vec2 density2)
+{
+	if(density1.x < density2.x)
+	{
+		return density1;
+	}
+	return density2;
+}
+
+// In Subtract, the inside of the second shape is turned into air, and its surface takes on a material of its own.
+vec2 CSG_Subtract(vec2 density1, vec2 density2)
+{
+	if(density1.x < -density2.x)
+	{
+		return vec2(-density2.x, 2.0f);
+	}
+	return density1;
+}
+
+// CSG Table Lookup
+float csgTable(int x, int y)
+{
+	return float(texelFetch(csgtex, (x + 8*y)).r);
+}
+
+// The Lipschitz bound of a CSG operation is stored in its seventh element. Zero means the shape is an exact distance function, with a bound of 1.
+float csgLipschitz(int i)
+{
+	float lipschitz = csgTable(6, i);
+	return (lipschitz == 0.0f) ? 1.0f : lipschitz;
+}
+
+// This is the density function that represents our entire terrain.
+// It is through this value that the terrain can be explored.
+vec2 DistanceField(vec3 worldPosition)
+{
+	// First, start with a flat plane
+	vec2 Density = ShapeFlatFloor(worldPosition);
+
+	// Then add some hills to the plane, perturbing them so that they are bumpy.
+	Density.x += (noise_g(worldPosition * 0.01f) * 70.0f);
+	Density.x += (noise_g(worldPosition * 0.05f) * 10.0f);
+	Density.x = BoundDistance(Density.x, terrainLipschitz);
+
+	// Perform CSG functions here. The first entry of the table is a placeholder, and is skipped.
+	for(int i = 1; i < int(numberOfCSG); i++)
+	{
+		// Only spheres are stored for now.
+		if(csgTable(1, i) != 0)
+		{
+			continue;
+		}
+
+		vec2 shape = CSG_Sphere(vec3(csgTable(2, i), csgTable(3, i), csgTable(4, i)), csgTable(5, i), worldPosition);
+		shape.x = BoundDistance(shape.x, csgLipschitz(i));
+
+		if(csgTable(0, i) == 0)
+		{
+			//Add mode
+			Density = CSG_Union(Density, shape);
+		}
+		if(csgTable(0, i) == 1)
+		{
+			//Subtract mode
+			Density = CSG_Subtract(Density, shape);
+		}
+	}
+
+	return Density;
+}
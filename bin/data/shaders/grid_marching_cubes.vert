@@ -4,7 +4,10 @@
 // Author: J. Brown (1201717)
 // Date: 19/01/2016
 // Purpose: A simple pass-through shader, for grid-based marching cubes. Passes not only the position of the vertices after a screen transform, but also their original world-space positions before camera transforms.
-// Additionally, vertices sent to the geometry shader know the scale of the grid, which is encoded in the R channel of the vertex colour.
+// Additionally, vertices sent to the geometry shader know the scale of the grid, from the gridscale uniform.
+// The grid's vertices are spaced for the finest LOD shell; positionScale stretches them out for the coarser shells.
+// The grid itself has no vertex data: with generatedGrid set, each point is placed from its vertex ID, as the points of a generatedGridSize lattice
+// (Z varying fastest, then Y, then X), generatedGridSpacing apart. Without it, as for the active cell list, the position attribute is used.
 uniform mat4 modelViewMatrix;
 uniform mat4 viewMatrix;
 uniform mat4 projectionMatrix;
@@ -21,6 +24,11 @@ in vec4 texcoord;
 
 uniform float gridscale;
 uniform vec3 gridoffset;
+uniform float positionScale;
+
+uniform float generatedGrid;
+uniform vec3 generatedGridSize;
+uniform float generatedGridSpacing;
 
 out vec4 worldspaceposition;
 out float worldspacescale;
@@ -42,10 +50,21 @@ void main()
 	// Terrain scaling
 
 
-	worldspaceposition = (position + vec4(gridoffset,1.0));
+	vec3 pointposition = position.xyz;
+	if (generatedGrid > 0.5)
+	{
+		int sizeY = int(generatedGridSize.y);
+		int sizeZ = int(generatedGridSize.z);
+		ivec3 point = ivec3(gl_VertexID / (sizeY * sizeZ), (gl_VertexID / sizeZ) % sizeY, gl_VertexID % sizeZ);
+		pointposition = vec3(point) * generatedGridSpacing;
+	}
+
+	vec4 gridposition = vec4(pointposition * positionScale, 1.0);
+
+	worldspaceposition = (gridposition + vec4(gridoffset,1.0));
 	worldspacescale = gridscale;
 
 	gridoffset_g = gridoffset;
-	gl_Position = position;
+	gl_Position = gridposition;
 
 }
\ No newline at end of file
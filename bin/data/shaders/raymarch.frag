@@ -1,182 +1,252 @@
 #version 330
 
 uniform vec2 screenResolution = vec2(400, 240);
-uniform vec3 cameraPosition = vec3(0,0,-5);
-uniform vec3 cameraUpVector = vec3(0,1,0);
-uniform vec3 cameraLookTarget = vec3(0,0,0);
 uniform int numIterations = 256;
 uniform float maximumDepth = 1500.0f;
 uniform vec4 skyColour = vec4(0.8f,0.8f,1.0f,1);
 uniform float time;
-uniform float numberOfCSG;
-uniform sampler3D noisetex;
 
-
-uniform samplerBuffer csgtex;
+// Marching mode. 0 is the original fixed half-step march; 1 is enhanced sphere tracing, which over-relaxes each step and falls back when it overshoots.
+uniform int marchMode = 0;
+// Over-relaxation factor for enhanced sphere tracing, in [1, 2).
+uniform float relaxation = 1.6f;
+// Replaces the shaded image with a heatmap of the number of steps each ray took.
+uniform int showStepHeatmap = 0;
+
+// Which pass is being drawn. 0 is the full-resolution shading pass; 1 is the low-resolution cone-marching prepass, which only writes out
+// how far each block of pixels can safely skip before the full pass starts marching.
+uniform int renderPass = 0;
+// How many full-resolution pixels wide each prepass pixel is.
+uniform float prepassScale = 8.0f;
+// The prepass results, read by the full pass when useStartDepth is set.
+uniform sampler2D startDepthTex;
+uniform int useStartDepth = 0;
+
+// Temporal reprojection. The previous frame's hit distances, and the camera they were rendered from, are used to guess how far each ray can safely skip this frame.
+uniform sampler2D previousDepthTex;
+uniform int useReprojection = 0;
+// Fraction of the reprojected distance to back off by, to allow for surfaces the history didn't see exactly.
+uniform float reprojectionMargin = 0.05f;
+
+// Reduced-rate rendering: how the target of the shading pass maps onto the full-resolution screen. 0 is one fragment per pixel. 1 is the half-width
+// checkerboard, where each fragment marches one of a pair of neighbouring pixels, alternating with frameParity. 2 is the quarter-resolution periphery,
+// where each fragment marches through the middle of a 2x2 block. 3 is the fovea: one fragment per pixel again, but only within foveaRadius of the centre.
+// The screen is rebuilt from these targets by raymarch_resolve.frag.
+uniform int marchLayout = 0;
+uniform int frameParity = 0;
+uniform float foveaRadius = 0.35f;
+
+// Shadows. Marched soft shadows take at most shadowSteps steps. Alternatively, the sun's visibility can come from a light-space shadow map,
+// rendered by pass 2 of this shader: each texel holds how far a ray from the light plane travels before it meets the terrain.
+uniform int shadowSteps = 64;
+uniform int useShadowMap = 0;
+uniform sampler2D shadowMapTex;
+uniform vec2 shadowMapResolution = vec2(512, 512);
+// The shadow map is a square, shadowMapExtent wide, centred over shadowMapCentre; its plane sits shadowMapHeight above that point towards the light.
+uniform vec3 shadowMapCentre;
+uniform float shadowMapExtent = 2000.0f;
+uniform float shadowMapHeight = 1000.0f;
+// Sharpness of the exponential shadow comparison.
+uniform float shadowMapSharpness = 0.5f;
+
+// Direction towards the sun. Shared by the lighting, shadows and fog.
+uniform vec3 sunDirection = vec3(0.7071068, 0.7071068, 0.0);
 
 
 in vec2 texCoord;
-out vec4 finalColor;
+layout(location = 0) out vec4 finalColor;
+// Hit distance of each ray, kept for the next frame to reproject.
+layout(location = 1) out vec4 finalDepth;
 
 precision highp float;
 
 // Raymarching Shader
 
 
-// Noise. Borrowed from: https://gist.github.com/patriciogonzalezvivo/670c22f3966e662d2f83
+// Scales a distance by the reciprocal of its Lipschitz bound, so that it can safely be stepped by in full. Only the enhanced march, the cone prepass
+// and the shadow map pass rely on this; the original march keeps the raw distances and takes half-steps instead.
+float BoundDistance(float distance, float lipschitz)
+{
+	if(marchMode == 1 || renderPass != 0)
+	{
+		return distance / max(lipschitz, 1.0f);
+	}
+	return distance;
+}
 
+// The terrain itself. The distance to the noise terrain is divided by its Lipschitz bound (terrainLipschitz) in enhanced mode, so that it never oversteps the surface.
+#pragma include "density.glsl"
 
-float hash(float n) { return fract(sin(n) * 1e4); }
-float hash(vec2 p) { return fract(1e4 * sin(17.0 * p.x + p.y * 0.1) * (0.1 + abs(sin(p.y * 13.0 + p.x)))); }
+// The camera's rays, and the projection back onto last frame's screen.
+#pragma include "camera.glsl"
 
-float noise_g(vec3 x) {
-    const vec3 step = vec3(110, 241, 171);
+// Lighting functions
 
-    vec3 i = floor(x);
-    vec3 f = fract(x);
+float softShadow(vec3 rayOrigin, vec3 rayDirection, float minimumDistance, float maximumDistance, float coefficient)
+{
+	float shadowResult = 1.0f;
+	float t = minimumDistance;
 
-    // For performance, compute the base input to a 1D hash from the integer part of the argument and the 
-    // incremental change to the 1D based on the 3D -> 1D wrapping
-    float n = dot(i, step);
+	// The number of steps is capped, so that no single pixel can take an unbounded amount of time.
+	for(int step = 0; step < shadowSteps && t < maximumDistance; step++)
+	{
+		float shadowDistance = DistanceField(rayOrigin + (rayDirection*t)).x;
+		if(shadowDistance < 0.001)
+		{
+			return 0.0f;
+		}
+		shadowResult = min(shadowResult, coefficient * (shadowDistance/t));
+		t += shadowDistance;
+	}
 
-    vec3 u = f * f * (3.0 - 2.0 * f);
-    return mix(mix(mix( hash(n + dot(step, vec3(0, 0, 0))), hash(n + dot(step, vec3(1, 0, 0))), u.x),
-                   mix( hash(n + dot(step, vec3(0, 1, 0))), hash(n + dot(step, vec3(1, 1, 0))), u.x), u.y),
-               mix(mix( hash(n + dot(step, vec3(0, 0, 1))), hash(n + dot(step, vec3(1, 0, 1))), u.x),
-                   mix( hash(n + dot(step, vec3(0, 1, 1))), hash(n + dot(step, vec3(1, 1, 1))), u.x), u.y), u.z);
+	return shadowResult;
 }
 
+// Builds the axes of the shadow map's plane, which faces the light.
+void ShadowMapBasis(vec3 lightDirection, out vec3 lightRight, out vec3 lightUp)
+{
+	lightRight = normalize(cross(vec3(0.0f, 0.0f, 1.0f), lightDirection));
+	lightUp = cross(lightDirection, lightRight);
+}
+
+// Looks up the sun's visibility at a position from the shadow map. Returns a negative value if the position is outside of the map.
+float ShadowMapVisibility(vec3 worldPosition, vec3 lightDirection)
+{
+	vec3 lightRight;
+	vec3 lightUp;
+	ShadowMapBasis(lightDirection, lightRight, lightUp);
+
+	vec3 planeOrigin = shadowMapCentre + (lightDirection * shadowMapHeight);
+	vec3 relativePosition = worldPosition - planeOrigin;
+
+	vec2 shadowMapPosition = vec2(dot(relativePosition, lightRight), dot(relativePosition, lightUp)) / shadowMapExtent + 0.5f;
+	float depth = -dot(relativePosition, lightDirection);
 
-//// Raymarching + CSG Functions
+	if(any(lessThan(shadowMapPosition, vec2(0.0f))) || any(greaterThanEqual(shadowMapPosition, vec2(1.0f))) || depth < 0.0f)
+	{
+		return -1.0f;
+	}
 
+	// Exponential comparison: fully lit in front of the stored hit, fading off smoothly behind it. The bias of one texel keeps surfaces from shadowing themselves.
+	float storedDepth = texelFetch(shadowMapTex, ivec2(shadowMapPosition * shadowMapResolution), 0).r;
+	float bias = shadowMapExtent / shadowMapResolution.x;
+	return clamp(exp(shadowMapSharpness * (storedDepth + bias - depth)), 0.0f, 1.0f);
+}
 
-// Set of functions for representing distance-fields for shapes.
-// The Y-Coordinate here is used for material/texturing information.
-vec2 ShapeFlatFloor(vec3 worldPosition)
+// Shadow map pass: marches from each texel of the light plane towards the terrain, and stores how far it got.
+float ShadowMapDepth(vec3 lightDirection)
 {
-	return vec2(worldPosition.y + 10.0f, 0.0f);
+	vec3 lightRight;
+	vec3 lightUp;
+	ShadowMapBasis(lightDirection, lightRight, lightUp);
+
+	vec2 shadowMapPosition = (floor(gl_FragCoord.xy) + 0.5f) / shadowMapResolution - 0.5f;
+	vec3 rayOrigin = shadowMapCentre + (lightDirection * shadowMapHeight) + (((lightRight * shadowMapPosition.x) + (lightUp * shadowMapPosition.y)) * shadowMapExtent);
+	float maximumDistance = shadowMapHeight * 2.0f;
+
+	float t = 0.0f;
+	for(int i = 0; i < numIterations && t < maximumDistance; i++)
+	{
+		float d = DistanceField(rayOrigin - (lightDirection * t)).x;
+		if(d < 0.01f)
+		{
+			break;
+		}
+		t += d;
+	}
+
+	return min(t, maximumDistance);
 }
 
-vec2 CSG_Sphere( vec3 position, float size, vec3 worldPosition)
+// Surface normal from the gradient of the distance field, taken over a tetrahedron anchored at the hit point.
+// The march has already sampled the hit point itself, so only the three other corners need evaluating. Unlike one-sided differences
+// along the axes, the corners are spread evenly around the point, so the normal doesn't lean towards any one axis.
+vec3 TetrahedralNormal(vec3 position, float positionDistance)
 {
-	return vec2(length(worldPosition - position) - size, 1.0f);
+	const float h = 0.1f;
+	float d1 = DistanceField(position + (vec3(-2.0f, 0.0f, 2.0f) * h)).x - positionDistance;
+	float d2 = DistanceField(position + (vec3(-2.0f, 2.0f, 0.0f) * h)).x - positionDistance;
+	float d3 = DistanceField(position + (vec3(0.0f, 2.0f, 2.0f) * h)).x - positionDistance;
+
+	// The inverse of the corner offsets, up to scale.
+	return normalize(vec3(d3 - d1 - d2, d2 + d3 - d1, d1 + d3 - d2));
 }
 
-// The CSG functions are simple to calculate;
-// In Union, Anything that is closer to the camera than the other will be shown instead.
-vec2 CSG_Union(vec2 density1, vec2 density2)
+vec4 Lambertian(vec3 worldPosition, vec3 currentNormal)
 {
-	if(density1.x < density2.x)
-	{
-		return density1;
-	}
-	else
+	float lightIntensity = dot(currentNormal, sunDirection);
+	if(lightIntensity > 0)
 	{
-		return density2;
+		return vec4(1.0, 1.0, 1.0, 1.0) * lightIntensity;
 	}
+	return vec4(0.0, 0.0, 0.0, 1.0);
 }
 
-vec2 CSG_Subtract(vec2 density1, vec2 density2)
+// The full-resolution pixel position that this fragment's ray goes through, following marchLayout. This must match the reconstruction in raymarch_resolve.frag.
+vec2 MarchedPixelPosition()
 {
-	if(density1.x < -density2.x)
+	vec2 fragment = floor(gl_FragCoord.xy);
+	if(marchLayout == 1)
 	{
-		density2.y = -2.0f;
-		return -density2;
+		// Checkerboard; of each pair of pixels on a row, the one where (x + y + frameParity) is even.
+		return vec2((fragment.x * 2.0f) + float((int(fragment.y) + frameParity) & 1), fragment.y) + 0.5f;
 	}
-	else
+	if(marchLayout == 2)
 	{
-		return density1;
+		// Periphery; the middle of the 2x2 block.
+		return (fragment * 2.0f) + 1.0f;
 	}
-	
+	return gl_FragCoord.xy;
 }
 
-// CSG Table Lookup
-float csgTable(int x, int y)
+// Whether a foveated pass can skip this fragment, as the resolve pass won't use it.
+bool OutsideFoveatedPass(vec2 pixelPosition)
 {
-	return float(texelFetch(csgtex, (x + 8*y)).r);
+	if(marchLayout == 3)
+	{
+		// The fovea is drawn over the square around it; the corners are left to the periphery.
+		return FoveaDistance(pixelPosition) >= foveaRadius;
+	}
+	if(marchLayout == 2)
+	{
+		// The resolve blends each periphery sample into the pixels up to two away from it, in its own 2x2 block and the blocks around it.
+		// Only if all of those are inside the fovea is the sample never used.
+		return (FoveaDistance(pixelPosition) + (3.0f / screenResolution.y)) < foveaRadius;
+	}
+	return false;
 }
 
-
-
-// This function calculates the density/distance field.
-vec2 DistanceField(vec3 worldPosition)
+// Uses the previous frame's hit distances to find a distance this ray can start marching from. Returns a negative distance if the history can't help.
+float ReprojectStartDistance(vec2 pixelPosition, vec3 rayDirection, float fovX, float fovY)
 {
-	// First, start with a flat plane
-	vec2 Density;
-
-	Density = ShapeFlatFloor(worldPosition);
-	
-	// Then add some hills to the plane, perturbing them so that they are bumpy.
-	Density.x += (noise_g(worldPosition * 0.01f) * 70.0f);
-	Density.x += (noise_g(worldPosition * 0.05f) * 10.0f);
-	
-	
-	// Perform CSG functions here.
-	
+	// First guess: this ray hits about as far away as the ray through the same pixel did last frame.
+	float guessDistance = texelFetch(previousDepthTex, ivec2(pixelPosition), 0).r;
 
-	for(int i = 1; i < int(numberOfCSG); i++)
+	vec2 previousPixel;
+	if(!ProjectToPreviousScreen(cameraPosition + (rayDirection * guessDistance), fovX, fovY, previousPixel))
 	{
-
-		if(csgTable(0, i) == 0)
-		{
-			//Add mode
-			if(csgTable(1, i) == 0)
-			{
-				// Sphere mode
-				Density = CSG_Union(Density, CSG_Sphere( vec3(csgTable(2, i), csgTable(3, i), csgTable(4, i)), csgTable(5, i), worldPosition));
-				
-			}
-		}
-		if(csgTable(0, i) == 1)
-		{
-			//Subtract mode
-			if(csgTable(1, i) == 0)
-			{
-				// Sphere mode
-				Density = CSG_Subtract(Density, CSG_Sphere( vec3(csgTable(2, i), csgTable(3, i), csgTable(4, i)), csgTable(5, i), worldPosition));
-			}
-		}
+		// Newly on screen; nothing to reproject.
+		return -1.0f;
 	}
-	
-	
-	
-	// Add some objects.
-	//Density = CSG_Union(Density, CSG_Sphere(vec3(0,cos(time*0.01f)*5,-50), 20, worldPosition));
-	//Density = CSG_Subtract(Density, CSG_Sphere(vec3(0,-60,50), 20, worldPosition));
 
-	
-
-	return Density;
-}
-
-// Lighting functions
-
-float softShadow(vec3 rayOrigin, vec3 rayDirection, float minimumDistance, float maximumDistance, float coefficient)
-{
-	float shadowResult = 1.0f;
-	for(float t = minimumDistance; t < maximumDistance;)
+	// Take the nearest hit around that pixel, so that edges of nearby surfaces aren't stepped past.
+	ivec2 centrePixel = ivec2(previousPixel);
+	ivec2 lastPixel = ivec2(screenResolution) - ivec2(1);
+	float previousDistance = maximumDepth;
+	for(int x = -1; x <= 1; x++)
 	{
-		float shadowDistance = DistanceField(rayOrigin + (rayDirection*t)).x;
-		if(shadowDistance < 0.001)
+		for(int y = -1; y <= 1; y++)
 		{
-			return 0.0f;
+			previousDistance = min(previousDistance, texelFetch(previousDepthTex, clamp(centrePixel + ivec2(x, y), ivec2(0), lastPixel), 0).r);
 		}
-		shadowResult = min(shadowResult, coefficient * (shadowDistance/t));
-		t += shadowDistance;
 	}
 
-	return shadowResult;
-}
+	// Find that hit in the world, and how far along this ray it lies, then back off a little.
+	vec3 previousRay = CameraRay(previousPixel, previousCameraPosition, previousCameraLookTarget, previousCameraUpVector, fovX, fovY);
+	vec3 previousHit = previousCameraPosition + (previousRay * previousDistance);
+	float startDistance = dot(previousHit - cameraPosition, rayDirection);
 
-vec4 Lambertian(vec3 worldPosition, vec3 currentNormal)
-{
-	vec3 lightDirection = normalize(vec3(1.0, 1.0, 0.0));
-	float lightIntensity = dot(currentNormal, lightDirection);
-	if(lightIntensity > 0)
-	{
-		return vec4(1.0, 1.0, 1.0, 1.0) * lightIntensity;
-	}
-	return vec4(0.0, 0.0, 0.0, 1.0);
+	return startDistance * (1.0f - reprojectionMargin);
 }
 
 void main()
@@ -185,26 +255,29 @@ void main()
 	// Based on collected works by Inigo Quilez.
 	// [link]
 
-	vec2 screenPosition = gl_FragCoord.xy / screenResolution;
-	
-	screenPosition.y = 1.0f - screenPosition.y;
-	screenPosition.x = 1.0f - screenPosition.x;
-	vec2 screenPositionOffset = -1.0f + 2.0f * screenPosition;
+	if(renderPass == 2)
+	{
+		finalColor = vec4(ShadowMapDepth(sunDirection), 0.0f, 0.0f, 1.0f);
+		return;
+	}
 
-	
+	// In the prepass, each fragment stands in for a block of full-resolution pixels, and its ray goes through the middle of that block.
+	vec2 pixelPosition = MarchedPixelPosition();
+	if(renderPass == 0 && OutsideFoveatedPass(pixelPosition))
+	{
+		// Whole quads of these are skipped at a time, as the fovea is one round patch of the screen.
+		discard;
+	}
+	if(renderPass == 1)
+	{
+		pixelPosition = min((floor(gl_FragCoord.xy) + 0.5f) * prepassScale, screenResolution);
+	}
 
 	// First, Initialize Camera
-	vec3 cameraDirection = normalize(cameraLookTarget - cameraPosition);
-	vec3 cameraRight = normalize(cross(cameraUpVector, cameraDirection));
-	vec3 cameraLowerBound = cross(cameraDirection, cameraRight);
-	vec3 cameraStep = cameraPosition + cameraDirection;
-
-	// .75 is fine for movement?
-	float FOVCalcX = 0.75f;
-	float FOVCalcY = 0.57f;
+	float FOVCalcX = CameraFovX;
+	float FOVCalcY = CameraFovY;
 	
-	vec3 eyeCoordinate = cameraStep + (screenPositionOffset.x * cameraRight * (screenResolution.x / screenResolution.y) * FOVCalcX) + (screenPositionOffset.y * cameraLowerBound * FOVCalcY);
-	vec3 rayDirection = normalize(eyeCoordinate - cameraPosition);
+	vec3 rayDirection = CameraRay(pixelPosition, cameraPosition, cameraLookTarget, cameraUpVector, FOVCalcX, FOVCalcY);
 
 	// Now, do raymarching.
 	vec3 minDistance = vec3(0.2, 0, 0);
@@ -223,33 +296,143 @@ void main()
 	// Evaluate distance field
 	int i = 0;
 	//for(rayDistanceTravelled = 1.0f; rayDistanceTravelled < 1500.0f;)
-	
-	for(i = 0; i < numIterations; ++i)
+
+	if(renderPass == 1)
 	{
+		// Cone-marching prepass.
+		// The cone around this ray is wide enough to contain the rays of every full-resolution pixel in the block. A step is only taken as far as the whole cone
+		// stays clear of the surface, so the distance reached is a safe place for all of those rays to start from.
+		float coneSlope = (0.75f * prepassScale * 2.0f * max(FOVCalcX, FOVCalcY)) / screenResolution.y;
+
+		for(i = 0; i < numIterations; ++i)
+		{
+			currentHitPosition = cameraPosition + (rayDirection * rayDistanceTravelled);
+			currentDistance = DistanceField(currentHitPosition);
 
-		// Update contact position
-		currentHitPosition = cameraPosition + (rayDirection * rayDistanceTravelled);
+			// The cone has touched the surface; the full pass takes it from here.
+			if(currentDistance.x < (coneSlope * rayDistanceTravelled) || (rayDistanceTravelled > maximumDepth))
+			{
+				break;
+			}
 
-		// Check distance
-		currentDistance = DistanceField(currentHitPosition);
+			rayDistanceTravelled += (currentDistance.x - (coneSlope * rayDistanceTravelled)) / (1.0f + coneSlope);
+		}
 
-		// If the ray hasn't hit anything yet, or if the step size becomes too small, stop here.
-		if(abs(currentDistance.x) < (0.001f * rayDistanceTravelled) || (rayDistanceTravelled > maximumDepth))
+		finalColor = vec4(min(rayDistanceTravelled, maximumDepth), 0.0f, 0.0f, 1.0f);
+		return;
+	}
+
+	if(useStartDepth > 0)
+	{
+		// Skip the empty space that the prepass has already cleared for this pixel.
+		rayDistanceTravelled = max(rayDistanceTravelled, texelFetch(startDepthTex, ivec2(pixelPosition / prepassScale), 0).r);
+	}
+
+	if(useReprojection > 0)
+	{
+		float reprojectedDistance = ReprojectStartDistance(pixelPosition, rayDirection, FOVCalcX, FOVCalcY);
+
+		// Only use the history if it lets the ray skip further, and doesn't land it inside the terrain. If it does, the history was wrong
+		// for this pixel (something has been uncovered or carved), and the ray marches in full instead.
+		if(reprojectedDistance > rayDistanceTravelled && DistanceField(cameraPosition + (rayDirection * reprojectedDistance)).x >= 0.0f)
 		{
-			break;
+			rayDistanceTravelled = reprojectedDistance;
+		}
+	}
+	
+	if(marchMode == 1)
+	{
+		// Enhanced sphere tracing, after Keinert et al. 2014, "Enhanced Sphere Tracing".
+		// Each step is over-relaxed, going further than the distance field says is safe. If the unbounding spheres of two steps no longer overlap,
+		// the step has jumped past the surface; the march goes back, and carries on with plain sphere tracing.
+		// The ray finishes once the surface is closer than the width of the pixel's cone at that distance, keeping the best candidate in case it never does.
+		float omega = relaxation;
+		float previousRadius = 0.0f;
+		float stepLength = 0.0f;
+		float pixelRadius = (2.0f * FOVCalcY) / screenResolution.y;
+		if(marchLayout == 2)
+		{
+			// Each periphery ray stands in for a 2x2 block, so its footprint is twice as wide.
+			pixelRadius *= 2.0f;
 		}
 
+		float candidateError = 1.0e20f;
+		float candidateDistanceTravelled = rayDistanceTravelled;
+		vec2 candidateDistance = currentDistance;
 
+		for(i = 0; i < numIterations; ++i)
+		{
+			currentHitPosition = cameraPosition + (rayDirection * rayDistanceTravelled);
+			currentDistance = DistanceField(currentHitPosition);
 
+			float radius = abs(currentDistance.x);
+			bool relaxationFailed = (omega > 1.0f) && ((radius + previousRadius) < stepLength);
 
+			if(relaxationFailed)
+			{
+				// Overshot; step back to where the last step started, and stop relaxing.
+				stepLength -= omega * stepLength;
+				omega = 1.0f;
+			}
+			else
+			{
+				stepLength = currentDistance.x * omega;
+			}
 
+			previousRadius = radius;
 
-		// Advance ray forwards by current step size.
-		rayDistanceTravelled += (currentDistance.x * 0.5f);
+			if(!relaxationFailed)
+			{
+				float error = radius / rayDistanceTravelled;
+				if(error < candidateError)
+				{
+					candidateDistanceTravelled = rayDistanceTravelled;
+					candidateDistance = currentDistance;
+					candidateError = error;
+				}
+
+				// Cone-bound exit: the surface is within this pixel's footprint.
+				if(error < pixelRadius)
+				{
+					break;
+				}
+			}
 
+			if(rayDistanceTravelled > maximumDepth)
+			{
+				break;
+			}
 
-		
+			rayDistanceTravelled += stepLength;
+		}
+
+		if(rayDistanceTravelled <= maximumDepth)
+		{
+			rayDistanceTravelled = candidateDistanceTravelled;
+			currentDistance = candidateDistance;
+		}
+	}
+	else
+	{
+		for(i = 0; i < numIterations; ++i)
+		{
+
+			// Update contact position
+			currentHitPosition = cameraPosition + (rayDirection * rayDistanceTravelled);
+
+			// Check distance
+			currentDistance = DistanceField(currentHitPosition);
+
+			// If the ray hasn't hit anything yet, or if the step size becomes too small, stop here.
+			if(abs(currentDistance.x) < (0.001f * rayDistanceTravelled) || (rayDistanceTravelled > maximumDepth))
+			{
+				break;
+			}
+
+			// Advance ray forwards by current step size.
+			rayDistanceTravelled += (currentDistance.x * 0.5f);
 
+		}
 	}
 
 	if(rayDistanceTravelled > maximumDepth)
@@ -276,13 +459,7 @@ void main()
 		
 
 		// Calculate hit normal
-		vec3 normalCalc = vec3(currentDistance.x - DistanceField((currentHitPosition - minDistance.xyy)).x,
-							   currentDistance.x - DistanceField((currentHitPosition - minDistance.yxy)).x, 
-							   currentDistance.x - DistanceField((currentHitPosition - minDistance.yyx)).x);
-
-		
-
-		currentHitNormal = normalize(normalCalc);
+		currentHitNormal = TetrahedralNormal(currentHitPosition, currentDistance.x);
 
 		
 
@@ -292,7 +469,17 @@ void main()
 
 		finalColor = (vec4(currentColour, 1.0f) * Lambertian(currentHitPosition, currentHitNormal));
 
-		finalColor.rgb *= softShadow(currentHitPosition, normalize(vec3(1.0, 1.0, 0.0)), 1.0f, 150.0f, 40);
+		// Use the shadow map where it covers this point, and march a shadow ray where it doesn't.
+		float sunVisibility = -1.0f;
+		if(useShadowMap > 0)
+		{
+			sunVisibility = ShadowMapVisibility(currentHitPosition, sunDirection);
+		}
+		if(sunVisibility < 0.0f)
+		{
+			sunVisibility = softShadow(currentHitPosition, sunDirection, 1.0f, 150.0f, 40);
+		}
+		finalColor.rgb *= sunVisibility;
 
 		finalColor += ambientCol;
 
@@ -302,7 +489,7 @@ void main()
 		// Fog depends on view distance
 		fogCoefficient = (length(currentHitPosition - cameraPosition) / maximumDepth);
 
-		float sunAmount = max( dot(normalize(currentHitPosition - cameraPosition), normalize(vec3(1.0, 1.0, 0.0))), 0.0f);
+		float sunAmount = max( dot(rayDirection, sunDirection), 0.0f);
 
 		vec4 fogColour = mix(skyColour, vec4(1.0f, 1.0f, 0.9f, 1.0f), pow(sunAmount, 8.0f));
 
@@ -318,7 +505,7 @@ void main()
 
 
 
-		float sunAmount = max( dot(normalize(currentHitPosition - cameraPosition), normalize(vec3(1.0, 1.0, 0.0))), 0.0f);
+		float sunAmount = max( dot(rayDirection, sunDirection), 0.0f);
 
 		vec4 fogColour = mix(skyColour, vec4(1.0f, 1.0f, 0.9f, 1.0f), pow(sunAmount, 8.0f));
 
@@ -330,7 +517,14 @@ void main()
 
 	//finalColor = texture(noisetex, screenPosition);
 
-	//finalColor = vec4(pow(float(i) / float(numIterations), 2.0f), float(i) / float(numIterations) * 0.5f, 0.0f, 1.0f);
+	// Keep the hit distance for the next frame. Rays that hit nothing count as hitting at the maximum depth.
+	finalDepth = vec4(min(rayDistanceTravelled, maximumDepth), 0.0f, 0.0f, 1.0f);
+
+	// Step-count heatmap: black rays took no steps, yellow ones used the whole budget.
+	if(showStepHeatmap > 0)
+	{
+		finalColor = vec4(pow(float(i) / float(numIterations), 2.0f), float(i) / float(numIterations) * 0.5f, 0.0f, 1.0f);
+	}
 
 	
 
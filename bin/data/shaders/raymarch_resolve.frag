@@ -0,0 +1,132 @@
+#version 330
+
+// Raymarched Terrain, Resolve Fragment Shader
+// Date: 19/10/2026
+// Purpose: When the raymarcher runs at a reduced rate, it marches into smaller targets, and this pass rebuilds the full-resolution screen from them.
+// In checkerboard mode, half of the pixels were marched into a half-width target. The other half are reprojected from last frame's image, and clamped
+// to the colours of their marched neighbours so that moving edges don't smear.
+// In foveated mode, the fovea was marched at full resolution and the periphery at quarter resolution; the periphery is filtered back up to full size.
+// The result, and a conservative hit distance for every pixel, become next frame's history.
+
+uniform sampler2D currentColourTex;
+uniform sampler2D currentDepthTex;
+uniform sampler2D foveaColourTex;
+uniform sampler2D foveaDepthTex;
+uniform sampler2D historyColourTex;
+uniform int historyValid = 0;
+
+uniform vec2 screenResolution;
+
+// Must match the rate settings given to raymarch.frag.
+uniform int renderRateMode = 0;
+uniform int frameParity = 0;
+uniform float foveaRadius = 0.35f;
+
+layout(location = 0) out vec4 finalColor;
+layout(location = 1) out vec4 finalDepth;
+
+#pragma include "camera.glsl"
+
+// Checkerboard mode. Marched pixels are read straight from the half-width target; the rest are rebuilt from history.
+void ResolveCheckerboard(ivec2 pixel, ivec2 lastPixel)
+{
+	// Whether the raymarcher marched this pixel this frame. This must match MarchedPixelPosition in raymarch.frag.
+	if(((pixel.x + pixel.y + frameParity) & 1) == 0)
+	{
+		finalColor = texelFetch(currentColourTex, ivec2(pixel.x >> 1, pixel.y), 0);
+		finalDepth = texelFetch(currentDepthTex, ivec2(pixel.x >> 1, pixel.y), 0);
+		return;
+	}
+
+	// The four direct neighbours were all marched this frame.
+	ivec2 neighbours[4] = ivec2[4](ivec2(-1, 0), ivec2(1, 0), ivec2(0, -1), ivec2(0, 1));
+
+	vec4 averageColour = vec4(0.0f);
+	vec4 minimumColour = vec4(1.0e20f);
+	vec4 maximumColour = vec4(-1.0e20f);
+	float minimumDepth = 1.0e20f;
+	float numNeighbours = 0.0f;
+
+	for(int n = 0; n < 4; n++)
+	{
+		ivec2 neighbour = pixel + neighbours[n];
+		if(any(lessThan(neighbour, ivec2(0))) || any(greaterThan(neighbour, lastPixel)))
+		{
+			continue;
+		}
+
+		ivec2 neighbourTexel = ivec2(neighbour.x >> 1, neighbour.y);
+		vec4 neighbourColour = texelFetch(currentColourTex, neighbourTexel, 0);
+		averageColour += neighbourColour;
+		minimumColour = min(minimumColour, neighbourColour);
+		maximumColour = max(maximumColour, neighbourColour);
+		minimumDepth = min(minimumDepth, texelFetch(currentDepthTex, neighbourTexel, 0).r);
+		numNeighbours += 1.0f;
+	}
+
+	averageColour /= max(numNeighbours, 1.0f);
+	finalColor = averageColour;
+
+	if(historyValid > 0)
+	{
+		// Last frame marched this pixel, but the camera has moved since. Find where this pixel's surface was on last frame's screen, taking the nearest
+		// neighbouring hit so that foreground edges win, and keep that colour's detail as long as it agrees with what's around it now.
+		vec2 pixelPosition = vec2(pixel) + 0.5f;
+		vec3 rayDirection = CameraRay(pixelPosition, cameraPosition, cameraLookTarget, cameraUpVector, CameraFovX, CameraFovY);
+
+		vec2 previousPixel;
+		if(ProjectToPreviousScreen(cameraPosition + (rayDirection * minimumDepth), CameraFovX, CameraFovY, previousPixel))
+		{
+			finalColor = clamp(texelFetch(historyColourTex, ivec2(previousPixel), 0), minimumColour, maximumColour);
+		}
+	}
+
+	// The nearest neighbouring hit, so that reprojecting from this pixel next frame stays on the safe side.
+	finalDepth = vec4(minimumDepth, 0.0f, 0.0f, 1.0f);
+}
+
+// Foveated mode. The fovea is read from the full-resolution target, and the periphery is filtered up from the quarter-resolution one.
+void ResolveFoveated(ivec2 pixel)
+{
+	if(FoveaDistance(vec2(pixel) + 0.5f) < foveaRadius)
+	{
+		finalColor = texelFetch(foveaColourTex, pixel, 0);
+		finalDepth = texelFetch(foveaDepthTex, pixel, 0);
+		return;
+	}
+
+	// Each periphery sample was marched through the middle of its 2x2 block. Blend the four around this pixel.
+	ivec2 lastTexel = textureSize(currentColourTex, 0) - ivec2(1);
+	vec2 samplePosition = ((vec2(pixel) + 0.5f) * 0.5f) - 0.5f;
+	ivec2 baseTexel = ivec2(floor(samplePosition));
+	vec2 blend = samplePosition - vec2(baseTexel);
+
+	vec4 colours[4];
+	float minimumDepth = 1.0e20f;
+	for(int n = 0; n < 4; n++)
+	{
+		ivec2 texel = clamp(baseTexel + ivec2(n & 1, n >> 1), ivec2(0), lastTexel);
+		colours[n] = texelFetch(currentColourTex, texel, 0);
+		minimumDepth = min(minimumDepth, texelFetch(currentDepthTex, texel, 0).r);
+	}
+
+	finalColor = mix(mix(colours[0], colours[1], blend.x), mix(colours[2], colours[3], blend.x), blend.y);
+
+	// The nearest of the blended hits, as in the checkerboard.
+	finalDepth = vec4(minimumDepth, 0.0f, 0.0f, 1.0f);
+}
+
+void main()
+{
+	ivec2 pixel = ivec2(gl_FragCoord.xy);
+	ivec2 lastPixel = ivec2(screenResolution) - ivec2(1);
+
+	if(renderRateMode == 2)
+	{
+		ResolveFoveated(pixel);
+	}
+	else
+	{
+		ResolveCheckerboard(pixel, lastPixel);
+	}
+}
@@ -1,160 +1,105 @@
 #version 150
 
-uniform sampler2DRect theTexture; // Using default pass-through texture
-uniform samplerBuffer csgtex;
-uniform float numberOfCSG;
-uniform vec2 screenResolution;
+uniform float gridscale;
+uniform vec3 gridoffset;
+uniform int densitySlice;
 
-uniform vec3 gridRes;
-uniform vec3 gridOffset;
+// Index of the last lattice point along each axis.
+uniform vec3 latticeMax;
+// Set when a coarser LOD shell surrounds this one.
+uniform int stitchBoundary;
 
-uniform float isolevel;
+// The cache is addressed toroidally; each lattice point is stored at its world-space lattice index, wrapped to the size of the cache.
+// latticeOrigin is the world-space lattice index of the grid's first lattice point, and latticeWrapOrigin is where that point is stored.
+uniform ivec3 latticeOrigin;
+uniform ivec3 latticeWrapOrigin;
 
-in vec2 texcoords;
-out vec4 finalColor;
-
-// This shader renders the density function at the grid sample points to a texture. 
-// What this means is that after the density function has been evaluated for these points, the resultant texture 
-// can then be used in the geometry shader in the next pass to sample the density with less intensity. 
-// This method is less accurate, but much faster.
-
-//
-// Noise functions borrowed from: [SOURCE]
-//
-float mod289(float x){return x - floor(x * (1.0 / 289.0)) * 289.0;}
-vec4 mod289(vec4 x){return x - floor(x * (1.0 / 289.0)) * 289.0;}
-vec4 perm(vec4 x){return mod289(((x * 34.0) + 1.0) * x);}
-
-float noise_g(vec3 p){
-    vec3 a = floor(p);
-    vec3 d = p - a;
-    d = d * d * (3.0 - 2.0 * d);
-
-    vec4 b = a.xxyy + vec4(0.0, 1.0, 0.0, 1.0);
-    vec4 k1 = perm(b.xyxy);
-    vec4 k2 = perm(k1.xyxy + b.zzww);
-
-    vec4 c = k2 + a.zzzz;
-    vec4 k3 = perm(c);
-    vec4 k4 = perm(c + 1.0);
+// When the cache is valid, any lattice point that was already inside the grid last time it was cached still holds the right density,
+// and doesn't need evaluating again. Only the slabs newly exposed by the grid moving are filled in.
+uniform int cacheValid;
+uniform ivec3 previousLatticeOrigin;
 
-    vec4 o1 = fract(k3 * (1.0 / 41.0));
-    vec4 o2 = fract(k4 * (1.0 / 41.0));
-
-    vec4 o3 = o2 * d.z + o1 * (1.0 - d.z);
-    vec2 o4 = o3.yw * d.x + o3.xz * (1.0 - d.x);
-
-    return o4.y * d.y + o4.x * (1.0 - d.y);
-}
-
-float CSG_Sphere( vec3 position, float size, vec3 worldspace )
-{
-	return length(worldspace - position) - size;
-}
-
-float CSG_Box(vec3 position, vec3 bounds, vec3 worldspace)
-{
-	return length(max(abs(worldspace - position) - bounds, 0.0));
-}
-
-float CSG_RoundBox(vec3 position, vec3 bounds, vec3 worldspace, float roundness)
-{
-	return length(max(abs(worldspace - position) - bounds, 0.0)) - roundness;
-}
+out vec4 finalColor;
 
-// And these functions are used to combine shapes and fields together.
+// This shader renders the density function at the grid's lattice points (the corners of the marching cubes cells) to a 3D texture, one Z-slice at a time.
+// What this means is that after the density function has been evaluated for these points, the resultant texture
+// can then be used in the geometry shader in the next pass to sample the density with less intensity:
+// neighbouring cells share corners, so each lattice point is now evaluated once per frame rather than once for every cell that touches it.
+// As the grid follows the camera in whole cells, most of the lattice carries over from one frame to the next, and is left as it is.
 
-float CSG_Union( float density1, float density2 )
-{
-	return max(density1, isolevel - density2);
-}
+// The density function itself is shared with the raymarcher.
+#pragma include "density.glsl"
 
-float CSG_Subtract( float density1, float density2 )
+// The grid polygonises the raw density, so it's never rescaled.
+float BoundDistance(float distance, float lipschitz)
 {
-	return min(density1, density2 - isolevel);
+	return distance;
 }
 
-float csgTable(int x, int y)
-{
-	//return 0.0f;
-	return float(texelFetch(csgtex, (x + 8*y)).r);
-}
-
-
-// This is the density function that represents our entire terrain. 
-// It is through this value that the terrain can be explored.
-//
-float DensityFunction(vec3 worldspaceposition)
+void main()
 {
-	float density = 0.0f;
-
-
-	// Set a floor at 0, 0, 0.
-	density = -worldspaceposition.y;
-
-	return density;
-	
-	// Perturb the surface with noise.
-	density += (noise_g(worldspaceposition / 80.0)) * 50.0f;
-	density += (noise_g(worldspaceposition / 40.0)) * 50.0f;
+	// Each fragment of the slice is one texel of the cache, and so one lattice point.
+	// Lattice point (0, 0, 0) is the far-left-bottom corner of the first cell, half a cell away from that cell's centre.
+	ivec3 latticeSize = ivec3(latticeMax) + ivec3(1);
+	ivec3 storagePoint = ivec3(ivec2(floor(gl_FragCoord.xy)), densitySlice);
+	ivec3 gridLatticePoint = (storagePoint - latticeWrapOrigin + latticeSize) % latticeSize;
+	vec3 latticePoint = vec3(gridLatticePoint);
 
-	// Perform CSG functions here.
+	bool onBoundary = any(equal(latticePoint, vec3(0.0f))) || any(equal(latticePoint, latticeMax));
 
-	for(int i = 1; i < int(numberOfCSG); i++)
+	if(cacheValid > 0)
 	{
+		// Where this point sat in the grid when it was last cached.
+		ivec3 previousPoint = latticeOrigin + gridLatticePoint - previousLatticeOrigin;
+		bool wasCached = all(greaterThanEqual(previousPoint, ivec3(0))) && all(lessThanEqual(previousPoint, ivec3(latticeMax)));
 
-		if(csgTable(0, i) == 0)
+		if(stitchBoundary > 0)
 		{
-			//Add mode
-			if(csgTable(1, i) == 0)
-			{
-				// Sphere mode
-				density = CSG_Union(density, CSG_Sphere( vec3(csgTable(2, i), csgTable(3, i), csgTable(4, i)), csgTable(5, i), worldspaceposition));
-			}
+			// Boundary points hold interpolated densities rather than true ones, so they're always evaluated again, as are points that have just left the boundary.
+			bool wasOnBoundary = any(equal(previousPoint, ivec3(0))) || any(equal(previousPoint, ivec3(latticeMax)));
+			wasCached = wasCached && !wasOnBoundary && !onBoundary;
 		}
-		if(csgTable(0, i) == 1)
+
+		if(wasCached)
 		{
-			//Subtract mode
-			if(csgTable(1, i) == 0)
-			{
-				// Sphere mode
-				density = CSG_Subtract(density, CSG_Sphere( vec3(csgTable(2, i), csgTable(3, i), csgTable(4, i)), csgTable(5, i), worldspaceposition));
-			}
+			discard;
 		}
 	}
-	//density = CSG_Union(density, CSG_Sphere(vec3(0.0f, 150.0f*sin(time), 0.0f), 25.0f, worldspaceposition));
-	//density = CSG_Subtract(density, CSG_Sphere(vec3(129.0f, 50.0f*sin(time), 0.0f), 50.0f, worldspaceposition));
-	//density = CSG_Union(density, CSG_RoundBox(vec3(0.0f, 50.0f, 130.0f), vec3(30.0f, 45.0f*sin(time)+45.0f, 30.0f*cos(time)+30.0f), worldspaceposition, 5.0f));
-	
-	
-	
-	
-
-	return density;
-}
 
+	if(stitchBoundary > 0 && onBoundary)
+	{
+		// The boundary of this shell touches the next shell out, which has cells twice the size. Its lattice only has the even points of this one,
+		// and it treats the density as linear in between. The odd boundary points here are given that same interpolated density, so that
+		// the surface meets the edges of the coarser cells in the same places from both sides, instead of leaving cracks along them.
+		// Across the middle of each coarse face the two surfaces can still part a little; the skirts in grid_marching_cubes.geom cover that.
+		vec3 oddAxes = mod(latticePoint, 2.0f);
+		vec3 lowPoint = latticePoint - oddAxes;
+		vec3 highPoint = latticePoint + oddAxes;
+
+		float totalDensity = 0.0f;
+		float numSamples = 0.0f;
+		for(int corner = 0; corner < 8; corner++)
+		{
+			vec3 pick = vec3(corner & 1, (corner >> 1) & 1, (corner >> 2) & 1);
 
-void main()
-{
+			// Only step towards the high point on the odd axes; the rest would repeat a sample.
+			if(any(greaterThan(pick, oddAxes)))
+			{
+				continue;
+			}
 
-	vec2 uv = gl_FragCoord.xy;
-	
-	// Calculate new coordinates for 3D texture sample
-	float xCoord = uv.x;
-	float zCoord = 0;
-	// Get wrapped amt 
-	while(xCoord > gridRes.x)
-	{
-		xCoord -= gridRes.x;
-		zCoord += 1.0f;
+			vec3 samplePoint = mix(lowPoint, highPoint, pick);
+			totalDensity += DistanceField(gridoffset + ((samplePoint - vec3(0.5f)) * gridscale)).x;
+			numSamples += 1.0f;
+		}
+
+		finalColor = vec4(totalDensity / numSamples, 0, 0, 1.0);
+		return;
 	}
-	float yCoord = screenResolution.y - uv.y;
 
-	// Sample density at this point
-	float density = DensityFunction(vec3(xCoord,yCoord,zCoord) + gridOffset );
+	vec3 worldspaceposition = gridoffset + ((latticePoint - vec3(0.5f)) * gridscale);
 
 	// Colour.R = sampled density.
+	finalColor = vec4(DistanceField(worldspaceposition).x, 0, 0, 1.0);
 
-	finalColor = vec4(density, 0, 0, 1.0);
-	
-}
\ No newline at end of file
+}
@@ -0,0 +1,96 @@
+#include "DebrisConsolidation.h"
+
+//Filename: DebrisConsolidation.cpp
+//Version: 1.0
+//Date: 19/10/2026
+//
+//Purpose: This is the implementation for turning settled debris back into terrain.
+
+DebrisConsolidator::DebrisConsolidator()
+{
+	oldestPendingTime = 0.0f;
+}
+
+DebrisConsolidator::~DebrisConsolidator()
+{
+	// Let the batch in flight finish, so its meshes are deleted; the ones still waiting are deleted here.
+	if (batch.valid())
+	{
+		batch.wait();
+	}
+
+	for (auto iter = pending.begin(); iter != pending.end(); ++iter)
+	{
+		delete iter->first;
+	}
+}
+
+void DebrisConsolidator::Add(ofMesh* mesh, ofVec3f position)
+{
+	if (pending.empty())
+	{
+		oldestPendingTime = ofGetElapsedTimef();
+	}
+	pending.push_back(std::make_pair(mesh, position));
+}
+
+bool DebrisConsolidator::Update(std::vector<ofVec4f>& spheres)
+{
+	bool finished = false;
+
+	// Pick up the last batch, if it's done.
+	if (batch.valid() && batch.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+	{
+		spheres = batch.get();
+		finished = true;
+	}
+
+	// Only one batch at a time; anything that settles in the meantime goes in the next.
+	if (!batch.valid() && !pending.empty())
+	{
+		if ((int)pending.size() >= BatchSize || ofGetElapsedTimef() - oldestPendingTime >= MaxWait)
+		{
+			batch = std::async(std::launch::async, &DebrisConsolidator::ConvertBatch, std::move(pending));
+			pending.clear();
+		}
+	}
+
+	return finished;
+}
+
+std::vector<ofVec4f> DebrisConsolidator::ConvertBatch(std::vector<std::pair<ofMesh*, ofVec3f>> fragments)
+{
+	std::vector<ofVec4f> spheres;
+	spheres.reserve(fragments.size());
+
+	for (auto iter = fragments.begin(); iter != fragments.end(); ++iter)
+	{
+		spheres.push_back(ConvertMeshToSphere(iter->first, iter->second));
+		delete iter->first;
+	}
+
+	return spheres;
+}
+
+ofVec4f DebrisConsolidator::ConvertMeshToSphere(const ofMesh* mesh, ofVec3f position)
+{
+	// Ordinarily, the mesh would be rendered in its own projection space, with a raytrace-type shader filling a 3D texture with density
+	// information, which the terrain renderers could use to recreate the shape exactly. Instead, the fragment is bounded by a box, and the
+	// sphere is sized to reach the box's corners.
+	const std::vector<ofVec3f>& vertices = mesh->getVertices();
+	if (vertices.empty())
+	{
+		return ofVec4f(position.x, position.y, position.z, 0.0f);
+	}
+
+	ofVec3f minVert = vertices[0];
+	ofVec3f maxVert = vertices[0];
+	for (auto iter = vertices.begin(); iter != vertices.end(); ++iter)
+	{
+		minVert.set(std::min(minVert.x, iter->x), std::min(minVert.y, iter->y), std::min(minVert.z, iter->z));
+		maxVert.set(std::max(maxVert.x, iter->x), std::max(maxVert.y, iter->y), std::max(maxVert.z, iter->z));
+	}
+
+	float radius = (maxVert - minVert).length() / 2.0f;
+	return ofVec4f(position.x, position.y, position.z, radius);
+}
@@ -0,0 +1,47 @@
+#pragma once
+#include <vector>
+#include <future>
+#include <utility>
+#include <algorithm>
+
+//Filename: DebrisConsolidation.h
+//Version: 1.0
+//Date: 19/10/2026
+//
+//Purpose: This is the header file for turning settled debris back into terrain.
+// Fragments that have come to rest (which Bullet reports by putting them to sleep) are handed to Add, and gathered into batches. Each batch is
+// converted on a worker thread, into one CSG sphere per fragment, and handed back from Update all at once, so that the CSG operations only
+// need uploading once for the whole batch rather than once for every fragment.
+
+#include "ofMain.h"
+
+class DebrisConsolidator
+{
+	private:
+		// Fragments waiting for a batch, and when the oldest of them arrived.
+		std::vector<std::pair<ofMesh*, ofVec3f>> pending;
+		float oldestPendingTime;
+
+		// The batch being converted, if there is one.
+		std::future<std::vector<ofVec4f>> batch;
+
+		static std::vector<ofVec4f> ConvertBatch(std::vector<std::pair<ofMesh*, ofVec3f>> fragments);
+
+	public:
+		// A batch is started once this many fragments are waiting, or once the oldest has waited MaxWait seconds.
+		int BatchSize = 16;
+		float MaxWait = 0.25f;
+
+		DebrisConsolidator();
+		~DebrisConsolidator();
+
+		// Queues a fragment's mesh (which the consolidator then owns, and deletes once converted) at the position it settled.
+		void Add(ofMesh* mesh, ofVec3f position);
+
+		// Call once a frame. Starts a batch if one's due, and returns true if one has finished, with a sphere (position, radius) per fragment.
+		bool Update(std::vector<ofVec4f>& spheres);
+
+		// NOTE: Due to time constraints, fragments are not scanned into the density field properly; each one simply becomes a sphere where it
+		// settled, big enough to hold the mesh.
+		static ofVec4f ConvertMeshToSphere(const ofMesh* mesh, ofVec3f position);
+};
@@ -0,0 +1,89 @@
+#include "DensityField.h"
+
+//Filename: DensityField.cpp
+//Version: 1.0
+//Date: 19/10/2026
+//
+//Purpose: This is the implementation of the CPU mirror of the terrain's density function. It must be kept in step with bin/data/shaders/density.glsl.
+
+const float DensityField::TerrainLipschitz = 3.8f;
+
+ofVec2f DensityField::ShapeFlatFloor(ofVec3f worldPosition)
+{
+	return ofVec2f(worldPosition.y + 10.0f, 0.0f);
+}
+
+ofVec2f DensityField::CSG_Sphere(ofVec3f position, float size, ofVec3f worldPosition)
+{
+	return ofVec2f((worldPosition - position).length() - size, 1.0f);
+}
+
+ofVec2f DensityField::CSG_Box(ofVec3f position, ofVec3f bounds, ofVec3f worldPosition)
+{
+	ofVec3f outside = worldPosition - position;
+	outside.set(std::max(fabs(outside.x) - bounds.x, 0.0f), std::max(fabs(outside.y) - bounds.y, 0.0f), std::max(fabs(outside.z) - bounds.z, 0.0f));
+	return ofVec2f(outside.length(), 1.0f);
+}
+
+ofVec2f DensityField::CSG_RoundBox(ofVec3f position, ofVec3f bounds, ofVec3f worldPosition, float roundness)
+{
+	ofVec2f box = CSG_Box(position, bounds, worldPosition);
+	return ofVec2f(box.x - roundness, box.y);
+}
+
+ofVec2f DensityField::CSG_Union(ofVec2f density1, ofVec2f density2)
+{
+	if (density1.x < density2.x)
+	{
+		return density1;
+	}
+	return density2;
+}
+
+ofVec2f DensityField::CSG_Subtract(ofVec2f density1, ofVec2f density2)
+{
+	if (density1.x < -density2.x)
+	{
+		return ofVec2f(-density2.x, 2.0f);
+	}
+	return density1;
+}
+
+ofVec2f DensityField::DistanceField(ofVec3f worldPosition, const std::vector<GLfloat>& csgOperations)
+{
+	// First, start with a flat plane
+	ofVec2f Density = ShapeFlatFloor(worldPosition);
+
+	// Then add some hills to the plane, perturbing them so that they are bumpy.
+	NoiseVolume* noise = NoiseVolume::Shared();
+	Density.x += noise->Sample(worldPosition * 0.01f) * 70.0f;
+	Density.x += noise->Sample(worldPosition * 0.05f) * 10.0f;
+
+	// Perform CSG functions here. The first entry of the table is a placeholder, and is skipped.
+	int numberOfCSG = csgOperations.size() / 8;
+	for (int i = 1; i < numberOfCSG; i++)
+	{
+		const GLfloat* operation = &csgOperations[i * 8];
+
+		// Only spheres are stored for now.
+		if (operation[1] != 0)
+		{
+			continue;
+		}
+
+		ofVec2f shape = CSG_Sphere(ofVec3f(operation[2], operation[3], operation[4]), operation[5], worldPosition);
+
+		if (operation[0] == 0)
+		{
+			//Add mode
+			Density = CSG_Union(Density, shape);
+		}
+		if (operation[0] == 1)
+		{
+			//Subtract mode
+			Density = CSG_Subtract(Density, shape);
+		}
+	}
+
+	return Density;
+}
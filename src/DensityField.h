@@ -0,0 +1,33 @@
+#pragma once
+#include <vector>
+
+//Filename: DensityField.h
+//Version: 1.0
+//Date: 19/10/2026
+//
+//Purpose: This is the header file for the CPU mirror of the terrain's density function.
+// The density function is defined once for the GPU, in bin/data/shaders/density.glsl, and this class evaluates the same field on the CPU so that the CPU side
+// (physics queries, tools, and the parity check in TerrainGridMarchingCubes) agrees with what's rendered. Each function here matches the one of the same name in that file.
+// As there, the X of each result is the density, negative inside the terrain, and the Y is the material.
+
+#include "ofMain.h"
+#include "NoiseVolume.h"
+
+class DensityField
+{
+	public:
+		// Upper bound on how fast the noise terrain's density changes per unit of distance; the derivation is next to terrainLipschitz in density.glsl.
+		static const float TerrainLipschitz;
+
+		static ofVec2f ShapeFlatFloor(ofVec3f worldPosition);
+		static ofVec2f CSG_Sphere(ofVec3f position, float size, ofVec3f worldPosition);
+		static ofVec2f CSG_Box(ofVec3f position, ofVec3f bounds, ofVec3f worldPosition);
+		static ofVec2f CSG_RoundBox(ofVec3f position, ofVec3f bounds, ofVec3f worldPosition, float roundness);
+
+		static ofVec2f CSG_Union(ofVec2f density1, ofVec2f density2);
+		static ofVec2f CSG_Subtract(ofVec2f density1, ofVec2f density2);
+
+		// The whole terrain, for a given CSG operations table. This is the unscaled field the grid polygonises; the raymarcher's Lipschitz scaling
+		// only changes distances away from the surface, not where the surface is.
+		static ofVec2f DistanceField(ofVec3f worldPosition, const std::vector<GLfloat>& csgOperations);
+};
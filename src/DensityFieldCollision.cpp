@@ -0,0 +1,218 @@
+#include "DensityFieldCollision.h"
+#include "BulletCollision/CollisionDispatch/btConvexConcaveCollisionAlgorithm.h"
+
+//Filename: DensityFieldCollision.cpp
+//Version: 1.0
+//Date: 19/10/2026
+//
+//Purpose: This is the implementation for colliding physics objects directly against the terrain's density field.
+
+DensityFieldShape::DensityFieldShape(const std::vector<GLfloat>* csgOperations, float isoLevel) : Lipschitz(DensityField::TerrainLipschitz)
+{
+	m_shapeType = CUSTOM_CONCAVE_SHAPE_TYPE;
+	localScaling.setValue(1, 1, 1);
+
+	CSGOperations = csgOperations;
+	IsoLevel = isoLevel;
+}
+
+float DensityFieldShape::Density(const btVector3& worldPosition) const
+{
+	return DensityField::DistanceField(ofVec3f(worldPosition.x(), worldPosition.y(), worldPosition.z()), *CSGOperations).x - IsoLevel;
+}
+
+btVector3 DensityFieldShape::Gradient(const btVector3& worldPosition, float density) const
+{
+	// Forward differences; the density at the point itself is already known, so this is only three more evaluations.
+	const float step = 0.25f;
+	return btVector3(Density(worldPosition + btVector3(step, 0, 0)) - density,
+		Density(worldPosition + btVector3(0, step, 0)) - density,
+		Density(worldPosition + btVector3(0, 0, step)) - density) / step;
+}
+
+void DensityFieldShape::getAabb(const btTransform& transform, btVector3& aabbMin, btVector3& aabbMax) const
+{
+	// The field goes on forever; this matches the bounds the terrain trimesh was given.
+	aabbMin.setValue(-10000, -10000, -10000);
+	aabbMax.setValue(10000, 10000, 10000);
+}
+
+void DensityFieldShape::processAllTriangles(btTriangleCallback* callback, const btVector3& aabbMin, const btVector3& aabbMax) const
+{
+	// There are no triangles. This is only reached by debug drawing, which has nothing to draw.
+}
+
+void DensityFieldShape::setLocalScaling(const btVector3& scaling)
+{
+	localScaling = scaling;
+}
+
+const btVector3& DensityFieldShape::getLocalScaling() const
+{
+	return localScaling;
+}
+
+void DensityFieldShape::calculateLocalInertia(btScalar mass, btVector3& inertia) const
+{
+	// Static only.
+	inertia.setValue(0, 0, 0);
+}
+
+const char* DensityFieldShape::getName() const
+{
+	return "DensityField";
+}
+
+DensityFieldCollisionAlgorithm::DensityFieldCollisionAlgorithm(const btCollisionAlgorithmConstructionInfo& constructionInfo, const btCollisionObjectWrapper* body0Wrap,
+	const btCollisionObjectWrapper* body1Wrap) : btActivatingCollisionAlgorithm(constructionInfo, body0Wrap, body1Wrap)
+{
+	manifold = m_dispatcher->getNewManifold(body0Wrap->getCollisionObject(), body1Wrap->getCollisionObject());
+}
+
+DensityFieldCollisionAlgorithm::~DensityFieldCollisionAlgorithm()
+{
+	if (manifold != 0)
+	{
+		m_dispatcher->releaseManifold(manifold);
+	}
+}
+
+void DensityFieldCollisionAlgorithm::processCollision(const btCollisionObjectWrapper* body0Wrap, const btCollisionObjectWrapper* body1Wrap, const btDispatcherInfo& dispatchInfo,
+	btManifoldResult* resultOut)
+{
+	// Work out which of the pair is the terrain.
+	bool swapped = body0Wrap->getCollisionShape()->getShapeType() == CUSTOM_CONCAVE_SHAPE_TYPE;
+	const btCollisionObjectWrapper* convexWrap = swapped ? body1Wrap : body0Wrap;
+	const btCollisionObjectWrapper* fieldWrap = swapped ? body0Wrap : body1Wrap;
+	const btConvexShape* convex = (const btConvexShape*)convexWrap->getCollisionShape();
+	const DensityFieldShape* field = (const DensityFieldShape*)fieldWrap->getCollisionShape();
+	const btTransform& convexTransform = convexWrap->getWorldTransform();
+
+	resultOut->setPersistentManifold(manifold);
+
+	// The terrain doesn't move, but the points on it do, as the surface is resampled every step; the old contacts are dropped and made again.
+	manifold->clearManifold();
+
+	// If the field says the whole shape is further from the surface than its bounding sphere reaches, there's nothing to do. Dividing by the
+	// Lipschitz bound keeps this conservative, as the density can change faster than distance does.
+	btVector3 centre;
+	btScalar radius;
+	convex->getBoundingSphere(centre, radius);
+	centre = convexTransform(centre);
+	float threshold = manifold->getContactBreakingThreshold();
+	if (field->Density(centre) / field->Lipschitz > radius + threshold)
+	{
+		return;
+	}
+
+	// Sample the hull. Small hulls (which the fragments are, once welded) are sampled at every point; anything else at its support points
+	// in the 26 directions around a cube, and in the direction straight into the terrain.
+	if (convex->getShapeType() == CONVEX_HULL_SHAPE_PROXYTYPE && ((const btConvexHullShape*)convex)->getNumPoints() <= MaxHullPoints)
+	{
+		const btConvexHullShape* hull = (const btConvexHullShape*)convex;
+		for (int i = 0; i < hull->getNumPoints(); i++)
+		{
+			AddContact(field, convexTransform(hull->getScaledPoint(i)), swapped, resultOut);
+		}
+	}
+	else
+	{
+		const btMatrix3x3& basis = convexTransform.getBasis();
+		for (int x = -1; x <= 1; x++)
+		{
+			for (int y = -1; y <= 1; y++)
+			{
+				for (int z = -1; z <= 1; z++)
+				{
+					if (x == 0 && y == 0 && z == 0)
+					{
+						continue;
+					}
+
+					btVector3 direction = btVector3(x, y, z).normalized();
+					AddContact(field, convexTransform(convex->localGetSupportingVertex(direction * basis)), swapped, resultOut);
+				}
+			}
+		}
+
+		btVector3 intoTerrain = -field->Gradient(centre, field->Density(centre));
+		if (intoTerrain.length2() > SIMD_EPSILON)
+		{
+			AddContact(field, convexTransform(convex->localGetSupportingVertex(intoTerrain.normalized() * basis)), swapped, resultOut);
+		}
+	}
+
+	resultOut->refreshContactPoints();
+}
+
+void DensityFieldCollisionAlgorithm::AddContact(const DensityFieldShape* field, const btVector3& point, bool swapped, btManifoldResult* resultOut)
+{
+	// Rule the point out cheaply if it can't be near the surface.
+	float density = field->Density(point);
+	if (density / field->Lipschitz > manifold->getContactBreakingThreshold())
+	{
+		return;
+	}
+
+	// Near the surface, the density divided by the length of its gradient approximates the distance to it.
+	btVector3 gradient = field->Gradient(point, density);
+	float gradientLength = gradient.length();
+	if (gradientLength < SIMD_EPSILON)
+	{
+		return;
+	}
+	btVector3 normal = gradient / gradientLength;
+	float distance = density / gradientLength;
+
+	// Bullet wants the normal on the second body, and the point on it.
+	if (swapped)
+	{
+		resultOut->addContactPoint(-normal, point, distance);
+	}
+	else
+	{
+		resultOut->addContactPoint(normal, point - (normal * distance), distance);
+	}
+}
+
+btScalar DensityFieldCollisionAlgorithm::calculateTimeOfImpact(btCollisionObject* body0, btCollisionObject* body1, const btDispatcherInfo& dispatchInfo, btManifoldResult* resultOut)
+{
+	// No continuous collision detection against the field.
+	return btScalar(1.0f);
+}
+
+void DensityFieldCollisionAlgorithm::getAllContactManifolds(btManifoldArray& manifoldArray)
+{
+	if (manifold != 0)
+	{
+		manifoldArray.push_back(manifold);
+	}
+}
+
+btCollisionAlgorithm* DensityFieldCollisionAlgorithm::CreateFunc::CreateCollisionAlgorithm(btCollisionAlgorithmConstructionInfo& constructionInfo,
+	const btCollisionObjectWrapper* body0Wrap, const btCollisionObjectWrapper* body1Wrap)
+{
+	// Other custom concave shapes (such as DensityFieldMeshShape) are made of triangles, and go through Bullet's own convex-concave algorithm.
+	bool swapped = body0Wrap->getCollisionShape()->getShapeType() == CUSTOM_CONCAVE_SHAPE_TYPE;
+	const btCollisionShape* fieldShape = swapped ? body0Wrap->getCollisionShape() : body1Wrap->getCollisionShape();
+	if (strcmp(fieldShape->getName(), "DensityField") != 0)
+	{
+		void* memory = constructionInfo.m_dispatcher1->allocateCollisionAlgorithm(sizeof(btConvexConcaveCollisionAlgorithm));
+		return new(memory) btConvexConcaveCollisionAlgorithm(constructionInfo, body0Wrap, body1Wrap, swapped);
+	}
+
+	void* memory = constructionInfo.m_dispatcher1->allocateCollisionAlgorithm(sizeof(DensityFieldCollisionAlgorithm));
+	return new(memory) DensityFieldCollisionAlgorithm(constructionInfo, body0Wrap, body1Wrap);
+}
+
+void DensityFieldCollisionAlgorithm::Register(btCollisionDispatcher* dispatcher)
+{
+	// The dispatcher keeps hold of the create function, so it has to outlive it.
+	static CreateFunc createFunc;
+
+	for (int shapeType = 0; shapeType < CONCAVE_SHAPES_START_HERE; shapeType++)
+	{
+		dispatcher->registerCollisionCreateFunc(shapeType, CUSTOM_CONCAVE_SHAPE_TYPE, &createFunc);
+		dispatcher->registerCollisionCreateFunc(CUSTOM_CONCAVE_SHAPE_TYPE, shapeType, &createFunc);
+	}
+}
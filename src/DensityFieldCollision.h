@@ -0,0 +1,84 @@
+#pragma once
+#include <vector>
+
+//Filename: DensityFieldCollision.h
+//Version: 1.0
+//Date: 19/10/2026
+//
+//Purpose: This is the header file for colliding physics objects directly against the terrain's density field.
+// Rather than polygonising the terrain around the camera and handing Bullet a trimesh (which has to be rebuilt whenever the camera moves far enough,
+// or the terrain is carved), the terrain is given to Bullet as a single shape that *is* the field. Whenever a convex object comes near it, contacts
+// are made by evaluating DensityField at points on the object's hull, with the field's gradient as the contact normal.
+// Because the shape reads the CSG operations table directly, carving the terrain costs nothing on the physics side.
+
+#include "ofMain.h"
+#include "ofxBullet.h"
+#include "DensityField.h"
+#include "BulletCollision/CollisionDispatch/btActivatingCollisionAlgorithm.h"
+#include "BulletCollision/CollisionDispatch/btCollisionDispatcher.h"
+#include "BulletCollision/CollisionShapes/btConcaveShape.h"
+
+// The terrain, as a Bullet shape. It's always in world space, so the object holding it should be left at the origin.
+// It has no triangles of its own to give Bullet; collisions against it are handled by DensityFieldCollisionAlgorithm.
+class DensityFieldShape : public btConcaveShape
+{
+	private:
+		btVector3 localScaling;
+
+	public:
+		// The table of CSG operations to evaluate, which is read every time, and the surface's isolevel.
+		const std::vector<GLfloat>* CSGOperations;
+		float IsoLevel;
+
+		// The field's Lipschitz bound, which turns a density into a distance that's safe to rule objects out with. Ruling out is only conservative
+		// if this is at least the field's real gradient bound, so it's fixed to the derived one, and not tied to any rendering setting.
+		const float Lipschitz;
+
+		DensityFieldShape(const std::vector<GLfloat>* csgOperations, float isoLevel);
+
+		// The field, offset so the surface is at zero: negative inside the terrain, positive outside.
+		float Density(const btVector3& worldPosition) const;
+
+		// The field's gradient at a point, which points out of the terrain. The density there is passed in, so it doesn't need evaluating again.
+		btVector3 Gradient(const btVector3& worldPosition, float density) const;
+
+		virtual void getAabb(const btTransform& transform, btVector3& aabbMin, btVector3& aabbMax) const;
+		virtual void processAllTriangles(btTriangleCallback* callback, const btVector3& aabbMin, const btVector3& aabbMax) const;
+		virtual void setLocalScaling(const btVector3& scaling);
+		virtual const btVector3& getLocalScaling() const;
+		virtual void calculateLocalInertia(btScalar mass, btVector3& inertia) const;
+		virtual const char* getName() const;
+};
+
+// Makes contacts between a convex shape and a DensityFieldShape. Compound shapes (such as the fractured fragments) are split into their convex
+// children by Bullet before they get here.
+class DensityFieldCollisionAlgorithm : public btActivatingCollisionAlgorithm
+{
+	private:
+		btPersistentManifold* manifold;
+
+		// Hulls with more points than this are sampled at their support points in a fixed set of directions instead.
+		static const int MaxHullPoints = 64;
+
+		void AddContact(const DensityFieldShape* field, const btVector3& point, bool swapped, btManifoldResult* resultOut);
+
+	public:
+		DensityFieldCollisionAlgorithm(const btCollisionAlgorithmConstructionInfo& constructionInfo, const btCollisionObjectWrapper* body0Wrap,
+			const btCollisionObjectWrapper* body1Wrap);
+		virtual ~DensityFieldCollisionAlgorithm();
+
+		virtual void processCollision(const btCollisionObjectWrapper* body0Wrap, const btCollisionObjectWrapper* body1Wrap, const btDispatcherInfo& dispatchInfo,
+			btManifoldResult* resultOut);
+		virtual btScalar calculateTimeOfImpact(btCollisionObject* body0, btCollisionObject* body1, const btDispatcherInfo& dispatchInfo, btManifoldResult* resultOut);
+		virtual void getAllContactManifolds(btManifoldArray& manifoldArray);
+
+		struct CreateFunc : public btCollisionAlgorithmCreateFunc
+		{
+			virtual btCollisionAlgorithm* CreateCollisionAlgorithm(btCollisionAlgorithmConstructionInfo& constructionInfo, const btCollisionObjectWrapper* body0Wrap,
+				const btCollisionObjectWrapper* body1Wrap);
+		};
+
+		// Tells the dispatcher to use this algorithm for every pairing of a convex shape with a DensityFieldShape, in either order.
+		// Custom concave shapes all share one shape type, so any other custom concave shape is handed to Bullet's convex-concave algorithm instead.
+		static void Register(btCollisionDispatcher* dispatcher);
+};
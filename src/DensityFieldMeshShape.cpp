@@ -0,0 +1,193 @@
+#include "DensityFieldMeshShape.h"
+
+//Filename: DensityFieldMeshShape.cpp
+//Version: 1.0
+//Date: 19/10/2026
+//
+//Purpose: This is the implementation of a terrain collision shape that polygonises the density field on demand.
+
+DensityFieldMeshShape::DensityFieldMeshShape(const std::vector<GLfloat>* csgOperations, const int* csgRevision, float isoLevel, float cellSize)
+{
+	m_shapeType = CUSTOM_CONCAVE_SHAPE_TYPE;
+	localScaling.setValue(1, 1, 1);
+
+	CSGOperations = csgOperations;
+	CSGRevision = csgRevision;
+	IsoLevel = isoLevel;
+	CellSize = cellSize;
+}
+
+long long DensityFieldMeshShape::CellKey(int x, int y, int z)
+{
+	// 21 bits for each coordinate, which is far more cells than the world has.
+	const long long mask = (1 << 21) - 1;
+	return ((long long)x & mask) | (((long long)y & mask) << 21) | (((long long)z & mask) << 42);
+}
+
+void DensityFieldMeshShape::PolygoniseCell(int x, int y, int z, std::vector<btVector3>& triangles) const
+{
+	// The corners are in the same order as in grid_marching_cubes.geom, so that the same triangle table gives the same triangles.
+	static const int cornerOffsets[8][3] = { { 0, 0, 1 }, { 1, 0, 1 }, { 1, 0, 0 }, { 0, 0, 0 }, { 0, 1, 1 }, { 1, 1, 1 }, { 1, 1, 0 }, { 0, 1, 0 } };
+	static const int edgeCorners[12][2] = { { 0, 1 }, { 1, 2 }, { 2, 3 }, { 3, 0 }, { 4, 5 }, { 5, 6 }, { 6, 7 }, { 7, 4 }, { 0, 4 }, { 1, 5 }, { 2, 6 }, { 3, 7 } };
+
+	btVector3 corners[8];
+	float densities[8];
+	int cubeIndex = 0;
+	for (int i = 0; i < 8; i++)
+	{
+		corners[i] = btVector3(x + cornerOffsets[i][0], y + cornerOffsets[i][1], z + cornerOffsets[i][2]) * CellSize;
+		densities[i] = DensityField::DistanceField(ofVec3f(corners[i].x(), corners[i].y(), corners[i].z()), *CSGOperations).x;
+		if (densities[i] > IsoLevel)
+		{
+			cubeIndex |= (1 << i);
+		}
+	}
+
+	// Entirely air, or entirely solid.
+	if (cubeIndex == 0 || cubeIndex == 255)
+	{
+		return;
+	}
+
+	for (int j = 0; j < 16 && triTableV[(cubeIndex * 16) + j] != -1; j++)
+	{
+		int edge = (int)triTableV[(cubeIndex * 16) + j];
+		int corner1 = edgeCorners[edge][0];
+		int corner2 = edgeCorners[edge][1];
+		float density1 = densities[corner1];
+		float density2 = densities[corner2];
+
+		// Interpolate along the edge, as InterpolateVertex does on the GPU.
+		if (fabs(IsoLevel - density1) < 0.00001f || fabs(density1 - density2) < 0.00001f)
+		{
+			triangles.push_back(corners[corner1]);
+		}
+		else if (fabs(IsoLevel - density2) < 0.00001f)
+		{
+			triangles.push_back(corners[corner2]);
+		}
+		else
+		{
+			triangles.push_back(corners[corner1].lerp(corners[corner2], (IsoLevel - density1) / (density2 - density1)));
+		}
+	}
+}
+
+const std::vector<btVector3>& DensityFieldMeshShape::GetCellTriangles(int x, int y, int z) const
+{
+	long long key = CellKey(x, y, z);
+
+	auto found = cellLookup.find(key);
+	if (found != cellLookup.end())
+	{
+		// Move it to the front, and rebuild it if the terrain's been edited since.
+		cellCache.splice(cellCache.begin(), cellCache, found->second);
+		CachedCell& cell = *found->second;
+		if (cell.CSGRevision != *CSGRevision)
+		{
+			cell.CSGRevision = *CSGRevision;
+			cell.Triangles.clear();
+			PolygoniseCell(x, y, z, cell.Triangles);
+		}
+		return cell.Triangles;
+	}
+
+	CachedCell cell;
+	cell.Key = key;
+	cell.CSGRevision = *CSGRevision;
+	PolygoniseCell(x, y, z, cell.Triangles);
+	cellCache.push_front(cell);
+	cellLookup[key] = cellCache.begin();
+
+	// Forget the least recently used cells.
+	while ((int)cellCache.size() > CacheCapacity)
+	{
+		cellLookup.erase(cellCache.back().Key);
+		cellCache.pop_back();
+	}
+
+	return cellCache.front().Triangles;
+}
+
+void DensityFieldMeshShape::processAllTriangles(btTriangleCallback* callback, const btVector3& aabbMin, const btVector3& aabbMax) const
+{
+	std::lock_guard<std::mutex> lock(cacheMutex);
+
+	int minX = (int)floor(aabbMin.x() / CellSize);
+	int minY = (int)floor(aabbMin.y() / CellSize);
+	int minZ = (int)floor(aabbMin.z() / CellSize);
+	int maxX = (int)floor(aabbMax.x() / CellSize);
+	int maxY = (int)floor(aabbMax.y() / CellSize);
+	int maxZ = (int)floor(aabbMax.z() / CellSize);
+
+	int triangleIndex = 0;
+	btVector3 triangle[3];
+
+	// Too big to polygonise; hand over what's cached instead.
+	double queryCells = (double)(maxX - minX + 1) * (double)(maxY - minY + 1) * (double)(maxZ - minZ + 1);
+	if (queryCells > MaxQueryCells)
+	{
+		for (auto cell = cellCache.begin(); cell != cellCache.end(); cell++)
+		{
+			if (cell->CSGRevision != *CSGRevision)
+			{
+				continue;
+			}
+
+			for (int i = 0; i + 2 < cell->Triangles.size(); i += 3)
+			{
+				triangle[0] = cell->Triangles[i];
+				triangle[1] = cell->Triangles[i + 1];
+				triangle[2] = cell->Triangles[i + 2];
+				callback->processTriangle(triangle, 0, triangleIndex++);
+			}
+		}
+		return;
+	}
+
+	for (int z = minZ; z <= maxZ; z++)
+	{
+		for (int y = minY; y <= maxY; y++)
+		{
+			for (int x = minX; x <= maxX; x++)
+			{
+				const std::vector<btVector3>& triangles = GetCellTriangles(x, y, z);
+				for (int i = 0; i + 2 < triangles.size(); i += 3)
+				{
+					triangle[0] = triangles[i];
+					triangle[1] = triangles[i + 1];
+					triangle[2] = triangles[i + 2];
+					callback->processTriangle(triangle, 0, triangleIndex++);
+				}
+			}
+		}
+	}
+}
+
+void DensityFieldMeshShape::getAabb(const btTransform& transform, btVector3& aabbMin, btVector3& aabbMax) const
+{
+	// The field goes on forever; this matches the bounds the terrain trimesh was given.
+	aabbMin.setValue(-10000, -10000, -10000);
+	aabbMax.setValue(10000, 10000, 10000);
+}
+
+void DensityFieldMeshShape::setLocalScaling(const btVector3& scaling)
+{
+	localScaling = scaling;
+}
+
+const btVector3& DensityFieldMeshShape::getLocalScaling() const
+{
+	return localScaling;
+}
+
+void DensityFieldMeshShape::calculateLocalInertia(btScalar mass, btVector3& inertia) const
+{
+	// Static only.
+	inertia.setValue(0, 0, 0);
+}
+
+const char* DensityFieldMeshShape::getName() const
+{
+	return "DensityFieldMesh";
+}
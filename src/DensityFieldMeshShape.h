@@ -0,0 +1,70 @@
+#pragma once
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <mutex>
+
+//Filename: DensityFieldMeshShape.h
+//Version: 1.0
+//Date: 19/10/2026
+//
+//Purpose: This is the header file for a terrain collision shape that polygonises the density field on demand.
+// Bullet collides convex objects against concave shapes by asking the shape for the triangles inside the object's bounding box. This shape answers
+// by running marching cubes on the CPU, over only the cells in that box, so the terrain is only ever polygonised where there's something to collide with it,
+// rather than the whole grid around the camera being fed back from the GPU.
+//
+// The cells are the same as the grid terrain's finest shell (corners on whole multiples of the cell size, the same corner order, and the same isolevel),
+// so the triangles match the ones drawn. Each cell's triangles are kept in a least-recently-used cache, and are thrown away once the CSG operations change.
+
+#include "ofMain.h"
+#include "ofxBullet.h"
+#include "DensityField.h"
+#include "tables.h"
+#include "BulletCollision/CollisionShapes/btConcaveShape.h"
+#include "BulletCollision/CollisionShapes/btTriangleCallback.h"
+
+class DensityFieldMeshShape : public btConcaveShape
+{
+	private:
+		struct CachedCell
+		{
+			long long Key;
+			int CSGRevision;
+			std::vector<btVector3> Triangles;
+		};
+
+		// Most recently used cells are at the front.
+		mutable std::list<CachedCell> cellCache;
+		mutable std::unordered_map<long long, std::list<CachedCell>::iterator> cellLookup;
+
+		// Triangle queries are const as far as Bullet is concerned, so a parallel narrowphase could make several at once, all using the cache.
+		mutable std::mutex cacheMutex;
+
+		btVector3 localScaling;
+
+		static long long CellKey(int x, int y, int z);
+		void PolygoniseCell(int x, int y, int z, std::vector<btVector3>& triangles) const;
+		const std::vector<btVector3>& GetCellTriangles(int x, int y, int z) const;
+
+	public:
+		// The table of CSG operations to polygonise, and its revision, both read every time; the surface's isolevel; and the side length of a cell.
+		const std::vector<GLfloat>* CSGOperations;
+		const int* CSGRevision;
+		float IsoLevel;
+		float CellSize;
+
+		// How many cells' triangles are kept.
+		int CacheCapacity = 16384;
+
+		// Queries covering more cells than this (such as debug drawing, which asks for everything) are only given the cells already in the cache.
+		int MaxQueryCells = 4096;
+
+		DensityFieldMeshShape(const std::vector<GLfloat>* csgOperations, const int* csgRevision, float isoLevel, float cellSize);
+
+		virtual void processAllTriangles(btTriangleCallback* callback, const btVector3& aabbMin, const btVector3& aabbMax) const;
+		virtual void getAabb(const btTransform& transform, btVector3& aabbMin, btVector3& aabbMax) const;
+		virtual void setLocalScaling(const btVector3& scaling);
+		virtual const btVector3& getLocalScaling() const;
+		virtual void calculateLocalInertia(btScalar mass, btVector3& inertia) const;
+		virtual const char* getName() const;
+};
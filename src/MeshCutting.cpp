@@ -480,6 +480,144 @@ ofVec3f LerpVec3(ofVec3f start, ofVec3f end, float amount)
 	return output;
 }
 
+// This function welds together vertices that lie within a tolerance of each other.
+// Rather than comparing every vertex against every other (as ofMesh::mergeDuplicateVertices does), each welded vertex is filed into a spatial hash of
+// tolerance-sized cells. A vertex can only be within the tolerance of welded vertices in its own cell or the 26 around it, so each lookup is constant time.
+void WeldMeshVertices(ofMesh* theMesh, float tolerance)
+{
+	if (theMesh->getNumVertices() == 0 || tolerance <= 0.0f)
+	{
+		return;
+	}
+
+	std::vector<ofVec3f>& vertices = theMesh->getVertices();
+	std::vector<ofVec3f>& normals = theMesh->getNormals();
+	std::vector<ofFloatColor>& colours = theMesh->getColors();
+	std::vector<ofVec2f>& texCoords = theMesh->getTexCoords();
+	bool hasNormals = theMesh->hasNormals();
+	bool hasColours = theMesh->hasColors();
+	bool hasTexCoords = theMesh->hasTexCoords();
+
+	std::vector<ofVec3f> newVertices;
+	std::vector<ofVec3f> newNormals;
+	std::vector<ofFloatColor> newColours;
+	std::vector<ofVec2f> newTexCoords;
+
+	// Old vertex index -> welded vertex index.
+	std::vector<ofIndexType> weldedIndex(vertices.size());
+
+	// Quantised cell -> welded vertices in that cell. The cell coordinates are packed 21 bits apiece into a single key.
+	std::unordered_map<unsigned long long, std::vector<ofIndexType>> cells;
+	cells.reserve(vertices.size());
+	auto cellKey = [](long long x, long long y, long long z)
+	{
+		const unsigned long long mask = (1 << 21) - 1;
+		return ((unsigned long long)x & mask) | (((unsigned long long)y & mask) << 21) | (((unsigned long long)z & mask) << 42);
+	};
+
+	float toleranceSquared = tolerance * tolerance;
+
+	for (ofIndexType i = 0; i < vertices.size(); i++)
+	{
+		ofVec3f vertex = vertices[i];
+		long long cellX = (long long)floor(vertex.x / tolerance);
+		long long cellY = (long long)floor(vertex.y / tolerance);
+		long long cellZ = (long long)floor(vertex.z / tolerance);
+
+		// Look for an existing welded vertex close enough to this one.
+		bool found = false;
+		for (int x = -1; x <= 1 && !found; x++)
+		{
+			for (int y = -1; y <= 1 && !found; y++)
+			{
+				for (int z = -1; z <= 1 && !found; z++)
+				{
+					auto cell = cells.find(cellKey(cellX + x, cellY + y, cellZ + z));
+					if (cell == cells.end())
+					{
+						continue;
+					}
+
+					for (auto candidate = cell->second.begin(); candidate != cell->second.end(); candidate++)
+					{
+						if (newVertices[*candidate].squareDistance(vertex) < toleranceSquared)
+						{
+							weldedIndex[i] = *candidate;
+							found = true;
+							break;
+						}
+					}
+				}
+			}
+		}
+
+		if (found)
+		{
+			continue;
+		}
+
+		// Nothing nearby, so this becomes a new welded vertex, keeping its own attributes.
+		weldedIndex[i] = newVertices.size();
+		cells[cellKey(cellX, cellY, cellZ)].push_back(newVertices.size());
+		newVertices.push_back(vertex);
+		if (hasNormals)
+		{
+			newNormals.push_back(normals[i]);
+		}
+		if (hasColours)
+		{
+			newColours.push_back(colours[i]);
+		}
+		if (hasTexCoords)
+		{
+			newTexCoords.push_back(texCoords[i]);
+		}
+	}
+
+	// Remap the indices. A mesh without indices draws its vertices in order, so that order becomes its index list.
+	std::vector<ofIndexType> oldIndices = theMesh->getIndices();
+	if (oldIndices.empty())
+	{
+		oldIndices.resize(vertices.size());
+		for (ofIndexType i = 0; i < vertices.size(); i++)
+		{
+			oldIndices[i] = i;
+		}
+	}
+
+	std::vector<ofIndexType> newIndices;
+	newIndices.reserve(oldIndices.size());
+	bool triangles = theMesh->getMode() == OF_PRIMITIVE_TRIANGLES;
+	for (ofIndexType i = 0; i < oldIndices.size(); i++)
+	{
+		if (triangles && i + 2 < oldIndices.size() && i % 3 == 0)
+		{
+			ofIndexType a = weldedIndex[oldIndices[i]];
+			ofIndexType b = weldedIndex[oldIndices[i + 1]];
+			ofIndexType c = weldedIndex[oldIndices[i + 2]];
+
+			// Triangles that have collapsed to a line or a point are of no use to anyone, least of all Bullet.
+			if (a != b && b != c && a != c)
+			{
+				newIndices.push_back(a);
+				newIndices.push_back(b);
+				newIndices.push_back(c);
+			}
+			i += 2;
+			continue;
+		}
+
+		newIndices.push_back(weldedIndex[oldIndices[i]]);
+	}
+
+	theMesh->clear();
+	theMesh->addVertices(newVertices);
+	theMesh->addNormals(newNormals);
+	theMesh->addColors(newColours);
+	theMesh->addTexCoords(newTexCoords);
+	theMesh->addIndices(newIndices);
+}
+
 // This function slices a physics object into two new physics objects & meshes.
 std::vector<std::pair<ofMesh*, ofxBulletCustomShape*>> SlicePhysicsObject(ofxBulletCustomShape* physicsObject, ofMesh* physicsObjectMesh, ofVec3f planePoint, ofVec3f planeNormalVector, ofxBulletWorldRigid* theWorld, bool deleteOriginal, bool addToWorld)
 {
@@ -821,7 +959,9 @@ std::vector<std::pair<ofMesh*, ofxBulletCustomShape*>> VoronoiFracture(ofxBullet
 
 				// Iterating over this mesh, so we store only the "inside" mesh
 				cellOutputMesh = sliced.at(0);
-				//cellOutputMesh->mergeDuplicateVertices(); // simplify mesh
+
+				// Each cut duplicates the vertices along the cut, so weld them back together before the next one; otherwise they pile up slice after slice.
+				WeldMeshVertices(cellOutputMesh, 0.5f);
 
 
 			}
@@ -835,7 +975,6 @@ std::vector<std::pair<ofMesh*, ofxBulletCustomShape*>> VoronoiFracture(ofxBullet
 
 		// When we generate the physics mesh, we use convex hull (delauney triangulation) built into bullet.
 		// This prevents physics meshes with large numbers of vertices from being created by the repeated slicing.
-		//cellOutputMesh->mergeDuplicateVertices(); // simplify mesh
 		
 		newShape->addMesh(*cellOutputMesh, ofVec3f(1, 1, 1), true);
 		ofVec3f meshPosition = cellOutputMesh->getCentroid();
@@ -843,7 +982,8 @@ std::vector<std::pair<ofMesh*, ofxBulletCustomShape*>> VoronoiFracture(ofxBullet
 		ofVec3f newOffset = physicsObjectPosition + (distancer * distancer.length());
 		newShape->create(theWorld->world, newOffset, 1.0f);
 		newShape->add();
-		newShape->setActivationState(OFX_BT_ACTIVATION_STATE_DISABLE_DEACTIVATION);
+		// Fragments are allowed to sleep; once they do, they're turned back into terrain.
+		newShape->setActivationState(OFX_BT_ACTIVATION_STATE_ACTIVE);
 		newShape->activate();
 
 		outputShapes.push_back(std::make_pair(cellOutputMesh, newShape));
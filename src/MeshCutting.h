@@ -4,6 +4,7 @@
 #include "ofxVoro.h"
 #include <vector>
 #include <map>
+#include <unordered_map>
 
 
 //Filename: MeshCutting.h
@@ -45,6 +46,10 @@ float PlaneIntersectLine(ofVec3f planePoint, ofVec3f planeNormalVector, ofVec3f
 // This function allows us to linearly interpolate between two ofVec3f points.
 ofVec3f LerpVec3(ofVec3f start, ofVec3f end, float amount);
 
+// This function welds together vertices that lie within a tolerance of each other, carrying their normals, colours and texture coordinates along,
+// and drops any triangles that collapse as a result. It runs in linear time, so it's cheap enough for fragments and physics meshes.
+void WeldMeshVertices(ofMesh* theMesh, float tolerance);
+
 // This function slices a physics object into two new physics objects & meshes.
 std::vector<std::pair<ofMesh*, ofxBulletCustomShape*>> SlicePhysicsObject(ofxBulletCustomShape* physicsObject, ofMesh* physicsObjectMesh, ofVec3f planePoint, ofVec3f planeNormalVector, ofxBulletWorldRigid* theWorld, bool deleteOriginal, bool addToWorld);
 
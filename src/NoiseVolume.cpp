@@ -0,0 +1,119 @@
+#include "NoiseVolume.h"
+
+//Filename: NoiseVolume.cpp
+//Version: 1.0
+//Date: 19/10/2026
+//
+//Purpose: This is the implementation for a baked, tileable 3D noise volume.
+
+NoiseVolume::NoiseVolume()
+{
+	// Bake the value noise. Texel (x, y, z) holds the noise at lattice position (x, y, z) / TexelsPerCell.
+	texels.resize(Resolution * Resolution * Resolution);
+
+	for (int z = 0; z < Resolution; z++)
+	{
+		for (int y = 0; y < Resolution; y++)
+		{
+			for (int x = 0; x < Resolution; x++)
+			{
+				texels[x + (Resolution * (y + (Resolution * z)))] = ValueNoise((float)x / TexelsPerCell, (float)y / TexelsPerCell, (float)z / TexelsPerCell);
+			}
+		}
+	}
+
+	// Upload it as a repeating, linearly filtered 3D texture.
+	glGenTextures(1, &Texture);
+	glBindTexture(GL_TEXTURE_3D, Texture);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_REPEAT);
+	glTexImage3D(GL_TEXTURE_3D, 0, GL_R32F, Resolution, Resolution, Resolution, 0, GL_RED, GL_FLOAT, texels.data());
+	glBindTexture(GL_TEXTURE_3D, 0);
+}
+
+NoiseVolume::~NoiseVolume()
+{
+	glDeleteTextures(1, &Texture);
+}
+
+NoiseVolume* NoiseVolume::Shared()
+{
+	static NoiseVolume* sharedVolume = new NoiseVolume();
+	return sharedVolume;
+}
+
+void NoiseVolume::Bind(ofShader* shader, int textureLocation)
+{
+	shader->setUniformTexture("noisevolume", GL_TEXTURE_3D, Texture, textureLocation);
+	shader->setUniform1f("noiseVolumePeriod", Period);
+	shader->setUniform1f("noiseVolumeResolution", Resolution);
+}
+
+// Random value in [0, 1] at a lattice point. The lattice wraps every Period cells, which is what makes the volume tile.
+float NoiseVolume::LatticeValue(int x, int y, int z)
+{
+	unsigned int hash = ((unsigned int)(x % Period) * 73856093u) ^ ((unsigned int)(y % Period) * 19349663u) ^ ((unsigned int)(z % Period) * 83492791u);
+	hash ^= hash >> 13;
+	hash *= 0x5bd1e995u;
+	hash ^= hash >> 15;
+
+	return (float)(hash & 0xFFFFFF) / (float)0xFFFFFF;
+}
+
+// Smoothly interpolated value noise, as the shaders used to compute it.
+float NoiseVolume::ValueNoise(float x, float y, float z)
+{
+	int cellX = (int)floor(x);
+	int cellY = (int)floor(y);
+	int cellZ = (int)floor(z);
+
+	float fractX = x - cellX;
+	float fractY = y - cellY;
+	float fractZ = z - cellZ;
+
+	float u = fractX * fractX * (3.0f - (2.0f * fractX));
+	float v = fractY * fractY * (3.0f - (2.0f * fractY));
+	float w = fractZ * fractZ * (3.0f - (2.0f * fractZ));
+
+	float bottomFront = ofLerp(LatticeValue(cellX, cellY, cellZ), LatticeValue(cellX + 1, cellY, cellZ), u);
+	float topFront = ofLerp(LatticeValue(cellX, cellY + 1, cellZ), LatticeValue(cellX + 1, cellY + 1, cellZ), u);
+	float bottomBack = ofLerp(LatticeValue(cellX, cellY, cellZ + 1), LatticeValue(cellX + 1, cellY, cellZ + 1), u);
+	float topBack = ofLerp(LatticeValue(cellX, cellY + 1, cellZ + 1), LatticeValue(cellX + 1, cellY + 1, cellZ + 1), u);
+
+	return ofLerp(ofLerp(bottomFront, topFront, v), ofLerp(bottomBack, topBack, v), w);
+}
+
+// Texel lookup with GL_REPEAT wrapping.
+float NoiseVolume::Texel(int x, int y, int z)
+{
+	x = ((x % Resolution) + Resolution) % Resolution;
+	y = ((y % Resolution) + Resolution) % Resolution;
+	z = ((z % Resolution) + Resolution) % Resolution;
+
+	return texels[x + (Resolution * (y + (Resolution * z)))];
+}
+
+float NoiseVolume::Sample(ofVec3f position)
+{
+	// In texels, the shaders' texture coordinate is position * TexelsPerCell, offset by half a texel to land on texel centres;
+	// the offset cancels against GL_LINEAR's own half-texel shift, leaving a plain trilinear blend between the texels either side.
+	ofVec3f texelPosition = position * TexelsPerCell;
+
+	int texelX = (int)floor(texelPosition.x);
+	int texelY = (int)floor(texelPosition.y);
+	int texelZ = (int)floor(texelPosition.z);
+
+	float fractX = texelPosition.x - texelX;
+	float fractY = texelPosition.y - texelY;
+	float fractZ = texelPosition.z - texelZ;
+
+	float bottomFront = ofLerp(Texel(texelX, texelY, texelZ), Texel(texelX + 1, texelY, texelZ), fractX);
+	float topFront = ofLerp(Texel(texelX, texelY + 1, texelZ), Texel(texelX + 1, texelY + 1, texelZ), fractX);
+	float bottomBack = ofLerp(Texel(texelX, texelY, texelZ + 1), Texel(texelX + 1, texelY, texelZ + 1), fractX);
+	float topBack = ofLerp(Texel(texelX, texelY + 1, texelZ + 1), Texel(texelX + 1, texelY + 1, texelZ + 1), fractX);
+
+	return ofLerp(ofLerp(bottomFront, topFront, fractY), ofLerp(bottomBack, topBack, fractY), fractZ);
+}
@@ -0,0 +1,44 @@
+#pragma once
+#include <vector>
+
+//Filename: NoiseVolume.h
+//Version: 1.0
+//Date: 19/10/2026
+//
+//Purpose: This is the header file for a baked, tileable 3D noise volume.
+// The terrain's density functions used to build value noise from scratch on every evaluation, with eight sin-based hashes per octave.
+// This class bakes that value noise into a 3D texture once, at start-up, so that each octave becomes a single trilinear texture fetch.
+// The same texels are kept on the CPU, and Sample() filters them exactly as the GPU does, so the CPU can evaluate the same terrain.
+
+#include "ofMain.h"
+
+class NoiseVolume
+{
+	private:
+		std::vector<float> texels;
+
+		float LatticeValue(int x, int y, int z);
+		float ValueNoise(float x, float y, float z);
+		float Texel(int x, int y, int z);
+
+	public:
+		// The noise repeats every Period lattice cells, and each lattice cell is baked at TexelsPerCell texels along each axis.
+		// The smoothstep between lattice values is baked in, so the hardware's trilinear filter only has to blend between texels.
+		static const int Period = 32;
+		static const int TexelsPerCell = 4;
+		static const int Resolution = Period * TexelsPerCell;
+
+		GLuint Texture;
+
+		NoiseVolume();
+		~NoiseVolume();
+
+		// Binds the volume, and the uniforms needed to address it, to a shader that is currently in use.
+		void Bind(ofShader* shader, int textureLocation);
+
+		// Noise at a position given in lattice cells, filtered the same way as the GPU's trilinear fetch. Returns a value in [0, 1].
+		float Sample(ofVec3f position);
+
+		// The volume is the same for every terrain, so it's baked once and shared.
+		static NoiseVolume* Shared();
+};
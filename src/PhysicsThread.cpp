@@ -0,0 +1,335 @@
+#include "PhysicsThread.h"
+
+//Filename: PhysicsThread.cpp
+//Version: 1.0
+//Date: 19/10/2026
+//
+//Purpose: This is the implementation for running the physics simulation on a thread of its own.
+
+CommandQueue::CommandQueue() : head(0), tail(0)
+{
+	commands.resize(Capacity);
+}
+
+bool CommandQueue::Push(std::function<void()> command)
+{
+	unsigned int currentTail = tail.load(std::memory_order_relaxed);
+	unsigned int nextTail = (currentTail + 1) % Capacity;
+	if (nextTail == head.load(std::memory_order_acquire))
+	{
+		return false;
+	}
+
+	commands[currentTail] = std::move(command);
+	tail.store(nextTail, std::memory_order_release);
+	return true;
+}
+
+bool CommandQueue::Pop(std::function<void()>& command)
+{
+	unsigned int currentHead = head.load(std::memory_order_relaxed);
+	if (currentHead == tail.load(std::memory_order_acquire))
+	{
+		return false;
+	}
+
+	command = std::move(commands[currentHead]);
+	commands[currentHead] = nullptr;
+	head.store((currentHead + 1) % Capacity, std::memory_order_release);
+	return true;
+}
+
+PhysicsThread::PhysicsThread(ofxBulletWorldRigid* theWorld) : running(false), FixedStep(1.0f / 60.0f), MaxSubSteps(5), TimeScale(1.0f), Enabled(false), DroppedSteps(0)
+{
+	world = theWorld;
+	accumulator = 0.0;
+	renderAlpha = 1.0f;
+	frontSnapshotTime = std::chrono::steady_clock::now();
+	frontAccumulator = 0.0;
+	frontFixedStep = FixedStep;
+	frontSpeed = 0.0f;
+}
+
+PhysicsThread::~PhysicsThread()
+{
+	Stop();
+}
+
+void PhysicsThread::Start()
+{
+	if (running)
+	{
+		return;
+	}
+
+	running = true;
+	thread = std::thread(&PhysicsThread::Run, this);
+}
+
+void PhysicsThread::Stop()
+{
+	if (!running)
+	{
+		return;
+	}
+
+	running = false;
+	thread.join();
+
+	// Anything queued after the thread's last look at the queue still needs doing.
+	std::lock_guard<std::mutex> lock(worldMutex);
+	RunCommands();
+	PublishSnapshot(false);
+}
+
+bool PhysicsThread::IsRunning()
+{
+	return running;
+}
+
+void PhysicsThread::Run()
+{
+	std::chrono::steady_clock::time_point lastTime = std::chrono::steady_clock::now();
+
+	while (running)
+	{
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		double realSeconds = std::chrono::duration<double>(now - lastTime).count();
+		lastTime = now;
+
+		{
+			std::lock_guard<std::mutex> lock(worldMutex);
+
+			bool changed = RunCommands();
+			int steps = Advance(realSeconds);
+
+			if (changed || steps > 0)
+			{
+				PublishSnapshot(steps > 0);
+			}
+		}
+
+		// Sleep until the next step is due; or, if nothing's being simulated, for a step's worth of real time before looking at the queue again.
+		float speed = Speed();
+		double wait = (Enabled && speed > 0.0f) ? (FixedStep - accumulator) / speed : FixedStep;
+		if (wait > 0.0)
+		{
+			std::this_thread::sleep_for(std::chrono::duration<double>(wait));
+		}
+	}
+}
+
+bool PhysicsThread::RunCommands()
+{
+	bool ranAny = false;
+	std::function<void()> command;
+	while (commands.Pop(command))
+	{
+		command();
+		ranAny = true;
+	}
+	return ranAny;
+}
+
+float PhysicsThread::Speed()
+{
+	// As fast as the old once-a-frame step went: twice real time, at full time scale.
+	return TimeScale * 2.0f;
+}
+
+int PhysicsThread::Advance(double realSeconds)
+{
+	if (!Enabled)
+	{
+		accumulator = 0.0;
+		return 0;
+	}
+
+	float step = FixedStep;
+	int maxSteps = std::max(1, (int)MaxSubSteps);
+
+	accumulator += realSeconds * Speed();
+	int steps = std::min((int)(accumulator / step), maxSteps);
+
+	for (int i = 0; i < steps; i++)
+	{
+		if (i == steps - 1)
+		{
+			CapturePreviousTransforms();
+		}
+
+		// No substeps of Bullet's own; the accumulator has already made this exactly one fixed step.
+		world->update(step, 0);
+		accumulator -= step;
+	}
+
+	// Couldn't keep up. Drop what's left over (bar the fraction of a step) and count it, rather than letting the next batch grow.
+	if (accumulator >= step)
+	{
+		int dropped = (int)(accumulator / step);
+		DroppedSteps += dropped;
+		accumulator -= dropped * (double)step;
+	}
+
+	return steps;
+}
+
+void PhysicsThread::CapturePreviousTransforms()
+{
+	previousTransforms.clear();
+
+	const btCollisionObjectArray& objects = world->world->getCollisionObjectArray();
+	for (int i = 0; i < objects.size(); i++)
+	{
+		const btRigidBody* body = btRigidBody::upcast(objects[i]);
+		if (body != 0 && !body->isStaticObject())
+		{
+			previousTransforms[body] = body->getWorldTransform();
+		}
+	}
+}
+
+void PhysicsThread::PublishSnapshot(bool stepped)
+{
+	backSnapshot.clear();
+	std::unordered_set<const btRigidBody*> nowSleeping;
+
+	const btCollisionObjectArray& objects = world->world->getCollisionObjectArray();
+	for (int i = 0; i < objects.size(); i++)
+	{
+		const btRigidBody* body = btRigidBody::upcast(objects[i]);
+		if (body == 0 || body->isStaticObject())
+		{
+			continue;
+		}
+
+		BodyState state;
+		state.Current = body->getWorldTransform();
+		state.LinearVelocity = body->getLinearVelocity();
+		state.AngularVelocity = body->getAngularVelocity();
+
+		state.Previous = state.Current;
+		if (stepped)
+		{
+			auto previous = previousTransforms.find(body);
+			if (previous != previousTransforms.end())
+			{
+				state.Previous = previous->second;
+			}
+		}
+		else
+		{
+			// Only this thread writes the front snapshot, so it can read it without the lock.
+			auto last = frontSnapshot.find(body);
+			if (last != frontSnapshot.end())
+			{
+				state.Previous = last->second.Previous;
+			}
+		}
+
+		backSnapshot[body] = state;
+
+		// Bullet puts bodies to sleep once they've been still for long enough. Tell the main thread about the ones that have just nodded off.
+		if (body->getActivationState() == ISLAND_SLEEPING)
+		{
+			nowSleeping.insert(body);
+			if (sleepingBodies.count(body) == 0 && BodyFellAsleep)
+			{
+				Post([this, body]() { BodyFellAsleep(body); });
+			}
+		}
+	}
+	std::swap(sleepingBodies, nowSleeping);
+
+	std::lock_guard<std::mutex> lock(snapshotMutex);
+	std::swap(frontSnapshot, backSnapshot);
+	frontSnapshotTime = std::chrono::steady_clock::now();
+	frontAccumulator = accumulator;
+	frontFixedStep = FixedStep;
+	frontSpeed = Enabled ? Speed() : 0.0f;
+}
+
+void PhysicsThread::Enqueue(std::function<void()> command)
+{
+	if (!running)
+	{
+		command();
+		return;
+	}
+
+	while (!commands.Push(command))
+	{
+		std::this_thread::yield();
+	}
+}
+
+void PhysicsThread::Post(std::function<void()> command)
+{
+	while (!posted.Push(command))
+	{
+		std::this_thread::yield();
+	}
+}
+
+void PhysicsThread::RunPosted()
+{
+	std::function<void()> command;
+	while (posted.Pop(command))
+	{
+		command();
+	}
+}
+
+void PhysicsThread::Step(float deltaTime)
+{
+	int steps = Advance(deltaTime);
+	PublishSnapshot(steps > 0);
+}
+
+std::mutex& PhysicsThread::WorldMutex()
+{
+	return worldMutex;
+}
+
+void PhysicsThread::ReadSnapshot()
+{
+	std::lock_guard<std::mutex> lock(snapshotMutex);
+	renderSnapshot = frontSnapshot;
+
+	// Drawing runs a step behind the simulation, so that there's always a step ahead to interpolate towards. How far towards it is however much
+	// simulated time there is that hasn't been stepped yet: what was left in the accumulator, plus whatever's passed on the thread since.
+	double unstepped = frontAccumulator;
+	if (running)
+	{
+		unstepped += std::chrono::duration<double>(std::chrono::steady_clock::now() - frontSnapshotTime).count() * frontSpeed;
+	}
+	renderAlpha = ofClamp((float)(unstepped / frontFixedStep), 0.0f, 1.0f);
+}
+
+bool PhysicsThread::GetInterpolatedTransform(const btRigidBody* body, ofMatrix4x4& transform)
+{
+	const BodyState* state = GetBodyState(body);
+	if (state == 0)
+	{
+		return false;
+	}
+
+	btTransform interpolated;
+	interpolated.setOrigin(state->Previous.getOrigin().lerp(state->Current.getOrigin(), renderAlpha));
+	interpolated.setRotation(state->Previous.getRotation().slerp(state->Current.getRotation(), renderAlpha));
+
+	float matrix[16];
+	interpolated.getOpenGLMatrix(matrix);
+	transform.set(matrix);
+	return true;
+}
+
+const PhysicsThread::BodyState* PhysicsThread::GetBodyState(const btRigidBody* body)
+{
+	auto state = renderSnapshot.find(body);
+	if (state == renderSnapshot.end())
+	{
+		return 0;
+	}
+	return &state->second;
+}
@@ -0,0 +1,158 @@
+#pragma once
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <functional>
+#include <unordered_map>
+#include <unordered_set>
+#include <algorithm>
+
+//Filename: PhysicsThread.h
+//Version: 1.0
+//Date: 19/10/2026
+//
+//Purpose: This is the header file for running the physics simulation on a thread of its own.
+// Stepping the world inline in ofApp::update meant a slow step made a slow frame. Here, the world is stepped at a fixed rate on its own thread, and after each
+// batch of steps, the transforms of every moving body are published as a snapshot. The render loop draws from the snapshot, interpolating between the last
+// two snapshots, so it never has to wait for (or read from) the world while it's being stepped.
+//
+// Steps are a fixed length of simulated time, whatever the frame rate. Real time (scaled by TimeScale) goes into an accumulator, and as many whole
+// steps are taken as it holds, up to MaxSubSteps at a time. If stepping can't keep up, the time left over is dropped rather than carried on into
+// ever longer batches, and counted in DroppedSteps, so that it shows up on a graph instead of as the simulation quietly slowing down.
+//
+// Anything else that changes the world is sent to the thread as a command, through a lock-free queue, and run between steps. Anything the physics thread
+// needs to hand back (such as the fragments of a shatter) is posted back the same way, and picked up by the main thread with RunPosted.
+// Bodies being put to sleep by Bullet are reported back the same way, through BodyFellAsleep.
+// The few things that have to touch the world from the main thread (building terrain colliders from the GPU, say) can take WorldMutex, which the thread
+// holds while it steps.
+//
+// When the thread isn't running, commands run as soon as they're queued, and Step runs the same accumulator inline, so that the rest of the program works the same either way.
+
+#include "ofMain.h"
+#include "ofxBullet.h"
+
+// A fixed-size, single-producer single-consumer queue of commands. One thread pushes, one thread pops, and neither ever waits on a lock.
+class CommandQueue
+{
+	private:
+		static const int Capacity = 4096;
+		std::vector<std::function<void()>> commands;
+		std::atomic<unsigned int> head;
+		std::atomic<unsigned int> tail;
+
+	public:
+		CommandQueue();
+
+		// Returns false if the queue is full.
+		bool Push(std::function<void()> command);
+
+		// Returns false if the queue is empty.
+		bool Pop(std::function<void()>& command);
+};
+
+class PhysicsThread
+{
+	public:
+		// A moving body's transform as of the last two snapshots, and its velocities as of the last.
+		struct BodyState
+		{
+			btTransform Previous;
+			btTransform Current;
+			btVector3 LinearVelocity;
+			btVector3 AngularVelocity;
+		};
+
+	private:
+		ofxBulletWorldRigid* world;
+		std::thread thread;
+		std::atomic<bool> running;
+		std::mutex worldMutex;
+
+		CommandQueue commands;
+		CommandQueue posted;
+
+		// Simulated time not yet stepped. Only touched by whichever thread is doing the stepping.
+		double accumulator;
+
+		// Where each moving body was before the last step of a batch, which is where drawing interpolates from.
+		std::unordered_map<const btRigidBody*, btTransform> previousTransforms;
+
+		// Bodies that were asleep as of the last snapshot, so that only the ones that have just gone to sleep are reported.
+		std::unordered_set<const btRigidBody*> sleepingBodies;
+
+		// The snapshot is double-buffered: the physics thread fills the back buffer, then swaps it to the front, holding snapshotMutex only for the swap.
+		// Along with the front buffer is what's needed to work out how far past its last step the simulation has got: the time it was published,
+		// and the accumulator, step length and speed as they were then.
+		std::unordered_map<const btRigidBody*, BodyState> frontSnapshot;
+		std::unordered_map<const btRigidBody*, BodyState> backSnapshot;
+		std::chrono::steady_clock::time_point frontSnapshotTime;
+		double frontAccumulator;
+		float frontFixedStep;
+		float frontSpeed;
+		std::mutex snapshotMutex;
+
+		// The main thread's copy of the front snapshot, taken once a frame by ReadSnapshot.
+		std::unordered_map<const btRigidBody*, BodyState> renderSnapshot;
+		float renderAlpha;
+
+		void Run();
+		bool RunCommands();
+
+		// Simulated seconds per real second.
+		float Speed();
+
+		// Adds real time to the accumulator and takes the steps it holds. Returns how many were taken.
+		int Advance(double realSeconds);
+		void CapturePreviousTransforms();
+
+		// If no step was taken since the last snapshot, bodies keep the transforms they were being interpolated from.
+		void PublishSnapshot(bool stepped);
+
+	public:
+		// Simulated time per step, in seconds, and the most steps taken in one go. Both can be set from the main thread at any time.
+		std::atomic<float> FixedStep;
+		std::atomic<int> MaxSubSteps;
+
+		// Simulation speed, and whether it's simulating at all. These can be set from the main thread at any time.
+		std::atomic<float> TimeScale;
+		std::atomic<bool> Enabled;
+
+		// How many steps' worth of time have been dropped for want of MaxSubSteps. It only ever counts up; compare it between frames.
+		std::atomic<int> DroppedSteps;
+
+		// Called on the main thread, from RunPosted, for each moving body Bullet has just put to sleep. Set it before starting the thread.
+		std::function<void(const btRigidBody*)> BodyFellAsleep;
+
+		PhysicsThread(ofxBulletWorldRigid* theWorld);
+		~PhysicsThread();
+
+		void Start();
+		void Stop();
+		bool IsRunning();
+
+		// Runs a command on the physics thread, between steps; or straight away, if the thread isn't running. Only the main thread should call this.
+		void Enqueue(std::function<void()> command);
+
+		// Hands a command back to the main thread. Only commands should call this.
+		void Post(std::function<void()> command);
+
+		// Runs everything posted back by the physics thread. Call once a frame, from the main thread.
+		void RunPosted();
+
+		// For when the thread isn't running: adds a frame's real time to the accumulator, steps the world inline, and publishes the snapshot.
+		void Step(float deltaTime);
+
+		// Held by the physics thread while it steps; take it before touching the world from the main thread.
+		std::mutex& WorldMutex();
+
+		// Takes this frame's copy of the snapshot. Call once a frame, from the main thread, before using the functions below.
+		void ReadSnapshot();
+
+		// A body's transform, interpolated between the last two snapshots. Returns false if the body hasn't been through a step yet.
+		bool GetInterpolatedTransform(const btRigidBody* body, ofMatrix4x4& transform);
+
+		// A body's state as of the last snapshot. Returns null if the body hasn't been through a step yet.
+		const BodyState* GetBodyState(const btRigidBody* body);
+};
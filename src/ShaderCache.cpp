@@ -0,0 +1,84 @@
+#include "ShaderCache.h"
+
+//Filename: ShaderCache.cpp
+//Version: 1.0
+//Date: 19/10/2026
+//
+//Purpose: This is the implementation for a process-wide registry of shader programs.
+
+std::map<std::string, ofShader*>& ShaderCache::Programs()
+{
+	static std::map<std::string, ofShader*> programs;
+	return programs;
+}
+
+ofShader* ShaderCache::Load(std::string vertexFile, std::string fragmentFile)
+{
+	std::string key = vertexFile + "|" + fragmentFile;
+
+	auto existing = Programs().find(key);
+	if (existing != Programs().end())
+	{
+		return existing->second;
+	}
+
+	ofShader* program = new ofShader();
+	program->load(vertexFile, fragmentFile);
+
+	Programs()[key] = program;
+	return program;
+}
+
+ofShader* ShaderCache::Load(std::string vertexFile, std::string geometryFile, std::string fragmentFile, GLenum geometryInputType, GLenum geometryOutputType,
+	int geometryOutputCount, std::vector<std::string> feedbackVaryings)
+{
+	// Everything set before linking is part of the program, so it's all part of the key.
+	std::string key = vertexFile + "|" + geometryFile + "|" + fragmentFile + "|" + ofToString(geometryInputType) + "|" + ofToString(geometryOutputType) + "|"
+		+ ofToString(geometryOutputCount);
+	for (auto iter = feedbackVaryings.begin(); iter != feedbackVaryings.end(); iter++)
+	{
+		key += "|" + *iter;
+	}
+
+	auto existing = Programs().find(key);
+	if (existing != Programs().end())
+	{
+		return existing->second;
+	}
+
+	ofShader* program = new ofShader();
+	program->setGeometryInputType(geometryInputType);
+	program->setGeometryOutputCount(geometryOutputCount);
+	program->setGeometryOutputType(geometryOutputType);
+
+	program->setupShaderFromFile(GL_VERTEX_SHADER, vertexFile);
+	program->setupShaderFromFile(GL_GEOMETRY_SHADER, geometryFile);
+	if (!fragmentFile.empty())
+	{
+		program->setupShaderFromFile(GL_FRAGMENT_SHADER, fragmentFile);
+	}
+
+	// Feedback varyings have to be set before the program is linked.
+	if (!feedbackVaryings.empty())
+	{
+		std::vector<const GLchar*> varyingNames;
+		for (auto iter = feedbackVaryings.begin(); iter != feedbackVaryings.end(); iter++)
+		{
+			varyingNames.push_back(iter->c_str());
+		}
+		glTransformFeedbackVaryings(program->getProgram(), varyingNames.size(), varyingNames.data(), GL_INTERLEAVED_ATTRIBS);
+	}
+	program->linkProgram();
+
+	Programs()[key] = program;
+	return program;
+}
+
+void ShaderCache::Clear()
+{
+	for (auto iter = Programs().begin(); iter != Programs().end(); iter++)
+	{
+		delete iter->second;
+	}
+	Programs().clear();
+}
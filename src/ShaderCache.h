@@ -0,0 +1,35 @@
+#pragma once
+#include <map>
+#include <string>
+#include <vector>
+
+//Filename: ShaderCache.h
+//Version: 1.0
+//Date: 19/10/2026
+//
+//Purpose: This is the header file for a process-wide registry of shader programs.
+// The terrains used to compile and link every one of their shaders in their constructors, and a grid terrain is built from scratch every time the raymarched terrain
+// needs a new physics mesh. With this registry, each combination of shader files is compiled and linked the first time it's asked for, and every later request,
+// from any terrain, gets that same program back. Programs with a geometry shader are also told apart by the settings that are fixed when they're linked
+// (geometry input and output types, maximum output vertices, and transform feedback varyings), so the same files with different settings get different programs.
+//
+// Programs are owned by the registry, and live until Clear() is called; the terrains that use them mustn't delete them.
+
+#include "ofMain.h"
+
+class ShaderCache
+{
+	private:
+		static std::map<std::string, ofShader*>& Programs();
+
+	public:
+		// A program with just a vertex and fragment shader.
+		static ofShader* Load(std::string vertexFile, std::string fragmentFile);
+
+		// A program with a geometry shader. The fragment shader can be left empty, and any transform feedback varyings are bound before linking.
+		static ofShader* Load(std::string vertexFile, std::string geometryFile, std::string fragmentFile, GLenum geometryInputType, GLenum geometryOutputType,
+			int geometryOutputCount, std::vector<std::string> feedbackVaryings);
+
+		// Deletes every program. Only safe once nothing is holding on to them.
+		static void Clear();
+};
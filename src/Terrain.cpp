@@ -20,6 +20,49 @@ Terrain::~Terrain()
 
 
 
+ofBufferObject* Terrain::SharedCSGBuffer()
+{
+	static ofBufferObject* sharedBuffer = 0;
+
+	if (sharedBuffer == 0)
+	{
+		// Start with a single blank operation. The first entry is a placeholder that the density functions skip, so this is an empty table.
+		sharedBuffer = new ofBufferObject();
+		sharedBuffer->allocate();
+		sharedBuffer->bind(GL_TEXTURE_BUFFER);
+		sharedBuffer->setData(std::vector<GLfloat>(8, 0.0f), GL_STREAM_DRAW);
+	}
+
+	return sharedBuffer;
+}
+
+ofTexture* Terrain::SharedCSGTable()
+{
+	static ofTexture* sharedTable = 0;
+
+	if (sharedTable == 0)
+	{
+		sharedTable = new ofTexture();
+		sharedTable->allocateAsBufferTexture(*SharedCSGBuffer(), GL_R32F);
+		sharedTable->setTextureMinMagFilter(GL_NEAREST, GL_NEAREST);
+	}
+
+	return sharedTable;
+}
+
+void Terrain::SetCSGOperations(const std::vector<GLfloat>& operations, int revision)
+{
+	csgOperations = operations;
+	csgRevision = revision;
+
+	static int uploadedRevision = -1;
+	if (revision != uploadedRevision)
+	{
+		SharedCSGBuffer()->setData(csgOperations, GL_STREAM_DRAW);
+		uploadedRevision = revision;
+	}
+}
+
 void Terrain::Rebuild()
 {
 
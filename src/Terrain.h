@@ -17,12 +17,18 @@ class Terrain
 		Terrain();
 		~Terrain();
 
-		// Store CSG operations as a texture
+		// Store CSG operations as a texture. Every terrain reads from the same texture, so an edit is only uploaded once, however many terrains are resident.
+		// csgRevision goes up with every edit, so that anything cached from the table can tell when it's stale.
 		std::vector<GLfloat> csgOperations;
-		ofBufferObject* csgBuffer;
+		int csgRevision = 0;
 		ofTexture* csgTable;
 		GLuint csgTableTex;
 
+		// Hands the terrain a new table of CSG operations. The shared texture is uploaded the first time any terrain is given a new revision.
+		void SetCSGOperations(const std::vector<GLfloat>& operations, int revision);
+		static ofBufferObject* SharedCSGBuffer();
+		static ofTexture* SharedCSGTable();
+
 		// Overrideable Techniques
 		virtual void Rebuild();
 		virtual void Update();
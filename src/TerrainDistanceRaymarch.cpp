@@ -15,38 +15,33 @@ TerrainDistanceRaymarch::TerrainDistanceRaymarch()
 {
 	// Set up framebuffer
 	RaymarchFramebuffer = new ofFbo();
+	HistoryFramebuffer = new ofFbo();
+	CheckerboardFramebuffer = new ofFbo();
+	PeripheryFramebuffer = new ofFbo();
+	ResolveFramebuffer = new ofFbo();
+	ConePrepassFramebuffer = new ofFbo();
 	
 	
-	// Set up shader
-	RaymarchShader = new ofShader();
+	// Set up shader. These are compiled once, and shared by every raymarched terrain.
+	RaymarchShader = ShaderCache::Load("data/shaders/raymarch.vert", "data/shaders/raymarch.frag");
+	ResolveShader = ShaderCache::Load("data/shaders/raymarch.vert", "data/shaders/raymarch_resolve.frag");
 
-	RaymarchShader->load("data/shaders/raymarch.vert", "data/shaders/raymarch.frag");
-
-	// Load noise texture
+	// The shadow map doesn't depend on the render resolution, so it's only allocated once.
 	ofDisableArbTex();
-	ofSetTextureWrap(GL_REPEAT, GL_REPEAT);
-	noiseTex = new ofImage("data/shaders/noise.png");
-	noiseTex->getTexture().setTextureWrap(GL_REPEAT, GL_REPEAT);
-	noiseTex->getTexture().enableMipmap();
-	noiseTex->getTexture().generateMipmap();
+	ShadowMapFramebuffer = new ofFbo();
+	ShadowMapFramebuffer->allocate(ShadowMapResolution, ShadowMapResolution, GL_R32F, 0);
+	ShadowMapFramebuffer->getTextureReference().setTextureMinMagFilter(GL_NEAREST, GL_NEAREST);
 
 	// Create CSG operations buffer
 	csgOperations.clear();
 	CSGAddSphere(ofVec3f(0, 0, 0), 10);
 
 
-	csgBuffer = new ofBufferObject();
-	csgBuffer->allocate();
-	csgBuffer->bind(GL_TEXTURE_BUFFER);
-	csgBuffer->setData(csgOperations, GL_STREAM_DRAW);
-
-	csgTable = new ofTexture();
-	csgTable->allocateAsBufferTexture(*csgBuffer, GL_R32F);
-	csgTable->setTextureMinMagFilter(GL_NEAREST, GL_NEAREST);
+	csgTable = SharedCSGTable();
 
 	RaymarchShader->begin();
-		//RaymarchShader->setUniformTexture("noisetex", noiseTex->getTexture(), 0);
 		RaymarchShader->setUniformTexture("csgtex", *csgTable, 1);
+		NoiseVolume::Shared()->Bind(RaymarchShader, 5);
 	RaymarchShader->end();
 
 	CurrentCamera = 0;
@@ -61,9 +56,52 @@ void TerrainDistanceRaymarch::Rebuild(int newX, int newY)
 	RaymarchResX = newX;
 	RaymarchResY = newY;
 
-	RaymarchFramebuffer->allocate(RaymarchResX, RaymarchResY, GL_RGBA, 0);
+	// The passes read each other's results with texelFetch, so the framebuffers need plain 2D textures rather than rectangle ones.
+	ofDisableArbTex();
+
+	// Colour, plus the hit distance of each ray for reprojection.
+	ofFbo::Settings raymarchSettings;
+	raymarchSettings.width = RaymarchResX;
+	raymarchSettings.height = RaymarchResY;
+	raymarchSettings.colorFormats.push_back(GL_RGBA);
+	raymarchSettings.colorFormats.push_back(GL_R32F);
+	raymarchSettings.numSamples = 0;
+
+	RaymarchFramebuffer->allocate(raymarchSettings);
+	HistoryFramebuffer->allocate(raymarchSettings);
+	ResolveFramebuffer->allocate(raymarchSettings);
 	
 	RaymarchFramebuffer->getTextureReference().setTextureMinMagFilter(GL_NEAREST, GL_NEAREST);
+	RaymarchFramebuffer->getTexture(1).setTextureMinMagFilter(GL_NEAREST, GL_NEAREST);
+	HistoryFramebuffer->getTextureReference().setTextureMinMagFilter(GL_NEAREST, GL_NEAREST);
+	HistoryFramebuffer->getTexture(1).setTextureMinMagFilter(GL_NEAREST, GL_NEAREST);
+	ResolveFramebuffer->getTextureReference().setTextureMinMagFilter(GL_NEAREST, GL_NEAREST);
+	ResolveFramebuffer->getTexture(1).setTextureMinMagFilter(GL_NEAREST, GL_NEAREST);
+
+	// The reduced-rate targets: half width for the checkerboard, and half of each side for the periphery. Both are rounded up to cover the screen.
+	ofFbo::Settings checkerboardSettings = raymarchSettings;
+	checkerboardSettings.width = (RaymarchResX + 1) / 2;
+	ofFbo::Settings peripherySettings = checkerboardSettings;
+	peripherySettings.height = (RaymarchResY + 1) / 2;
+
+	CheckerboardFramebuffer->allocate(checkerboardSettings);
+	PeripheryFramebuffer->allocate(peripherySettings);
+
+	CheckerboardFramebuffer->getTextureReference().setTextureMinMagFilter(GL_NEAREST, GL_NEAREST);
+	CheckerboardFramebuffer->getTexture(1).setTextureMinMagFilter(GL_NEAREST, GL_NEAREST);
+	PeripheryFramebuffer->getTextureReference().setTextureMinMagFilter(GL_NEAREST, GL_NEAREST);
+	PeripheryFramebuffer->getTexture(1).setTextureMinMagFilter(GL_NEAREST, GL_NEAREST);
+
+	// Nothing to reproject from yet.
+	historyValid = false;
+
+	// The prepass only needs one distance per pixel, rounded up so that the blocks cover the whole render.
+	int prepassX = (RaymarchResX + ConePrepassScale - 1) / ConePrepassScale;
+	int prepassY = (RaymarchResY + ConePrepassScale - 1) / ConePrepassScale;
+	ConePrepassFramebuffer->allocate(prepassX, prepassY, GL_R32F, 0);
+	ConePrepassFramebuffer->getTextureReference().setTextureMinMagFilter(GL_NEAREST, GL_NEAREST);
+
+	ofEnableArbTex();
 	
 
 }
@@ -73,46 +111,223 @@ void TerrainDistanceRaymarch::Draw()
 	// First, enable framebuffer.
 	ofDisableArbTex();
 	ofSetTextureWrap(GL_REPEAT, GL_REPEAT);
-	RaymarchFramebuffer->begin();
+
+	accum += 1;
+
+	// HistoryFramebuffer holds last frame's finished render. It can't be trusted if the terrain has been changed since, or if the render size has changed.
+	if (csgRevision != historyCsgRevision || previousResolution != ofVec2f(RaymarchResX, RaymarchResY))
+	{
+		historyValid = false;
+		historyCsgRevision = csgRevision;
+	}
+
+	// Bring the shadow map up to date, if it's in use.
+	if (ShadowMapEnabled && CurrentCamera != 0)
+	{
+		bool cameraStrayed = (CurrentCamera->getPosition() - shadowMapCentre).length() > (ShadowMapExtent * 0.25f);
+		if (!shadowMapValid || cameraStrayed || csgRevision != shadowMapCsgRevision)
+		{
+			RenderShadowMap();
+		}
+	}
+
+	// Cone-march the scene at low resolution first, to find how much empty space each block of pixels can skip.
+	if (ConePrepass)
+	{
+		ConePrepassFramebuffer->begin();
+		ofClear(ofColor::black);
+
+		RaymarchShader->begin();
+			SetRaymarchUniforms();
+			RaymarchShader->setUniform1i("renderPass", 1);
+
+			ofDrawRectangle(0, 0, ConePrepassFramebuffer->getWidth(), ConePrepassFramebuffer->getHeight());
+		RaymarchShader->end();
+
+		ConePrepassFramebuffer->end();
+	}
+
+	// March the full-resolution pixels. At a reduced rate, only some of them are marched, into smaller targets.
+	if (RenderRate == RATE_CHECKERBOARD)
+	{
+		MarchInto(CheckerboardFramebuffer, 1, ofRectangle(0, 0, CheckerboardFramebuffer->getWidth(), CheckerboardFramebuffer->getHeight()));
+	}
+	else if (RenderRate == RATE_FOVEATED)
+	{
+		// The fovea is a circle in the middle of the screen. It's marched at full resolution, over the square around it, and the rest of the screen at a quarter;
+		// both passes skip the pixels the other one covers.
+		float foveaPixels = FoveaRadius * RaymarchResY;
+		float foveaLeft = std::max(floor((RaymarchResX * 0.5f) - foveaPixels), 0.0f);
+		float foveaBottom = std::max(floor((RaymarchResY * 0.5f) - foveaPixels), 0.0f);
+		float foveaRight = std::min(ceil((RaymarchResX * 0.5f) + foveaPixels), (float)RaymarchResX);
+		float foveaTop = std::min(ceil((RaymarchResY * 0.5f) + foveaPixels), (float)RaymarchResY);
+
+		MarchInto(RaymarchFramebuffer, 3, ofRectangle(foveaLeft, foveaBottom, foveaRight - foveaLeft, foveaTop - foveaBottom));
+		MarchInto(PeripheryFramebuffer, 2, ofRectangle(0, 0, PeripheryFramebuffer->getWidth(), PeripheryFramebuffer->getHeight()));
+	}
+	else
+	{
+		MarchInto(RaymarchFramebuffer, 0, ofRectangle(0, 0, RaymarchResX, RaymarchResY));
+	}
+
+	if (RenderRate == RATE_FULL)
+	{
+		// Every pixel was marched, so this frame's render is the finished one.
+		std::swap(RaymarchFramebuffer, HistoryFramebuffer);
+	}
+	else
+	{
+		// Rebuild the full screen from the reduced-rate targets, then that becomes the finished render.
+		ofFbo* marchedFramebuffer = (RenderRate == RATE_CHECKERBOARD) ? CheckerboardFramebuffer : PeripheryFramebuffer;
+
+		ResolveFramebuffer->begin();
+		ResolveFramebuffer->activateAllDrawBuffers();
+		ofClear(ofColor::black);
+
+		ResolveShader->begin();
+			ResolveShader->setUniform2f("screenResolution", ofVec2f(RaymarchResX, RaymarchResY));
+			ResolveShader->setUniform1i("renderRateMode", RenderRate);
+			ResolveShader->setUniform1i("frameParity", (int)accum % 2);
+			ResolveShader->setUniform1f("foveaRadius", FoveaRadius);
+			ResolveShader->setUniform1i("historyValid", (historyValid && CurrentCamera != 0) ? 1 : 0);
+			ResolveShader->setUniformTexture("currentColourTex", marchedFramebuffer->getTexture(0), 0);
+			ResolveShader->setUniformTexture("currentDepthTex", marchedFramebuffer->getTexture(1), 1);
+			ResolveShader->setUniformTexture("historyColourTex", HistoryFramebuffer->getTexture(0), 2);
+			ResolveShader->setUniformTexture("foveaColourTex", RaymarchFramebuffer->getTexture(0), 3);
+			ResolveShader->setUniformTexture("foveaDepthTex", RaymarchFramebuffer->getTexture(1), 4);
+
+			// The history is reprojected from last frame's camera onto this one.
+			if (CurrentCamera != 0)
+			{
+				ResolveShader->setUniform3f("cameraPosition", CurrentCamera->getPosition());
+				ResolveShader->setUniform3f("cameraUpVector", CurrentCamera->getUpDir());
+				ResolveShader->setUniform3f("cameraLookTarget", CurrentCamera->getPosition() + (CurrentCamera->getLookAtDir() * 5.0f));
+				ResolveShader->setUniform3f("previousCameraPosition", previousCameraPosition);
+				ResolveShader->setUniform3f("previousCameraUpVector", previousCameraUpVector);
+				ResolveShader->setUniform3f("previousCameraLookTarget", previousCameraLookTarget);
+			}
+
+			ofDrawRectangle(0, 0, RaymarchResX, RaymarchResY);
+		ResolveShader->end();
+
+		ResolveFramebuffer->end();
+
+		std::swap(ResolveFramebuffer, HistoryFramebuffer);
+	}
+
+	// Remember this frame's camera for the next frame's reprojection.
+	if (CurrentCamera != 0)
+	{
+		previousCameraPosition = CurrentCamera->getPosition();
+		previousCameraUpVector = CurrentCamera->getUpDir();
+		previousCameraLookTarget = CurrentCamera->getPosition() + (CurrentCamera->getLookAtDir() * 5.0f);
+		previousResolution = ofVec2f(RaymarchResX, RaymarchResY);
+		historyValid = true;
+	}
+
+	// Now draw the terrain.
+	ofDisableDepthTest();
+	HistoryFramebuffer->draw(ofPoint(0, 0), ofGetWindowWidth(), ofGetWindowHeight());
+	ofEnableDepthTest();
+	ofEnableArbTex();
+}
+
+// Runs the shading pass over an area of a target. marchLayout says how the target's pixels map onto the full-resolution screen; see raymarch.frag.
+void TerrainDistanceRaymarch::MarchInto(ofFbo* target, int marchLayout, ofRectangle area)
+{
+	target->begin();
+	target->activateAllDrawBuffers();
 	
 	ofClear(ofColor::black);
 	
-	// Update csg operations table
-	csgBuffer->setData(csgOperations, GL_STREAM_DRAW);
-	
 	// Enable shader
 	RaymarchShader->begin();
+		SetRaymarchUniforms();
+		RaymarchShader->setUniform1i("renderPass", 0);
+		RaymarchShader->setUniform1i("marchLayout", marchLayout);
+		RaymarchShader->setUniform1i("useStartDepth", ConePrepass ? 1 : 0);
+		if (ConePrepass)
+		{
+			RaymarchShader->setUniformTexture("startDepthTex", ConePrepassFramebuffer->getTexture(), 2);
+		}
 
-	accum += 1;
+		RaymarchShader->setUniform1i("useShadowMap", (ShadowMapEnabled && shadowMapValid) ? 1 : 0);
+		if (ShadowMapEnabled && shadowMapValid)
+		{
+			RaymarchShader->setUniformTexture("shadowMapTex", ShadowMapFramebuffer->getTexture(), 4);
+		}
+
+		bool reproject = TemporalReprojection && historyValid && CurrentCamera != 0;
+		RaymarchShader->setUniform1i("useReprojection", reproject ? 1 : 0);
+		if (reproject)
+		{
+			RaymarchShader->setUniformTexture("previousDepthTex", HistoryFramebuffer->getTexture(1), 3);
+			RaymarchShader->setUniform3f("previousCameraPosition", previousCameraPosition);
+			RaymarchShader->setUniform3f("previousCameraUpVector", previousCameraUpVector);
+			RaymarchShader->setUniform3f("previousCameraLookTarget", previousCameraLookTarget);
+		}
+
+		// Draw rectangle
+		ofDrawRectangle(area);
+	
+	RaymarchShader->end();
+	target->end();
+}
+
+void TerrainDistanceRaymarch::RenderShadowMap()
+{
+	// Centre the map on the camera, snapped to whole texels so that the shadows don't shimmer as it follows.
+	float texelSize = ShadowMapExtent / ShadowMapResolution;
+	ofVec3f cameraPosition = CurrentCamera->getPosition();
+	shadowMapCentre = ofVec3f(floor(cameraPosition.x / texelSize), floor(cameraPosition.y / texelSize), floor(cameraPosition.z / texelSize)) * texelSize;
 
+	ShadowMapFramebuffer->begin();
+	ofClear(ofColor::black);
 
+	RaymarchShader->begin();
+		SetRaymarchUniforms();
+		RaymarchShader->setUniform1i("renderPass", 2);
+
+		ofDrawRectangle(0, 0, ShadowMapResolution, ShadowMapResolution);
+	RaymarchShader->end();
+
+	ShadowMapFramebuffer->end();
+
+	shadowMapCsgRevision = csgRevision;
+	shadowMapValid = true;
+}
+
+void TerrainDistanceRaymarch::SetRaymarchUniforms()
+{
 	// Update camera information.
 	if (CurrentCamera != 0)
 	{
 		RaymarchShader->setUniform2f("screenResolution", ofVec2f(RaymarchResX, RaymarchResY));
 		RaymarchShader->setUniform1i("numIterations", numIterations);
 		RaymarchShader->setUniform1f("maximumDepth", maximumDepth);
+		RaymarchShader->setUniform1i("marchMode", EnhancedSphereTracing ? 1 : 0);
+		RaymarchShader->setUniform1f("relaxation", Relaxation);
+		RaymarchShader->setUniform1f("terrainLipschitz", TerrainLipschitz);
+		RaymarchShader->setUniform1i("showStepHeatmap", ShowStepHeatmap ? 1 : 0);
+		RaymarchShader->setUniform1f("prepassScale", ConePrepassScale);
+		RaymarchShader->setUniform1i("marchLayout", 0);
+		RaymarchShader->setUniform1i("frameParity", (int)accum % 2);
+		RaymarchShader->setUniform1f("foveaRadius", FoveaRadius);
+		RaymarchShader->setUniform3f("sunDirection", SunDirection);
+		RaymarchShader->setUniform1i("shadowSteps", ShadowSteps);
+		RaymarchShader->setUniform2f("shadowMapResolution", ofVec2f(ShadowMapResolution, ShadowMapResolution));
+		RaymarchShader->setUniform3f("shadowMapCentre", shadowMapCentre);
+		RaymarchShader->setUniform1f("shadowMapExtent", ShadowMapExtent);
+		RaymarchShader->setUniform1f("shadowMapHeight", ShadowMapHeight);
 		RaymarchShader->setUniform3f("cameraPosition", CurrentCamera->getPosition());
 		RaymarchShader->setUniform3f("cameraUpVector", CurrentCamera->getUpDir());
 		RaymarchShader->setUniform3f("cameraLookTarget", CurrentCamera->getPosition() + (CurrentCamera->getLookAtDir() * 5.0f));
 		RaymarchShader->setUniform1f("numberOfCSG", csgOperations.size() / 8);
 		RaymarchShader->setUniform1f("time", accum);
 		RaymarchShader->setUniformTexture("csgtex", *csgTable, 1);
+		NoiseVolume::Shared()->Bind(RaymarchShader, 5);
 
 	}
-
-	// Draw rectangle
-	ofDrawRectangle(0, 0, RaymarchResX, RaymarchResY);
-	//ofRectangle(0, 0, RaymarchResX, RaymarchResY);
-	
-	RaymarchShader->end();
-	RaymarchFramebuffer->end();
-
-	// Now draw the terrain.
-	ofDisableDepthTest();
-	RaymarchFramebuffer->draw(ofPoint(0, 0), ofGetWindowWidth(), ofGetWindowHeight());
-	ofEnableDepthTest();
-	ofEnableArbTex();
 }
 
 // CSG Operations on this kind of terrain work by filling a texture buffer.
@@ -120,7 +335,8 @@ void TerrainDistanceRaymarch::Draw()
 // First element: Add/Subtract operation, 0 or 1
 // Second: Shape to be defined. 0: Sphere, 1: Box,
 // For spheres, the next 4 elements define the position & radius of the sphere.
-// The remaining two are left blank
+// Seventh: Lipschitz bound of the shape's distance function, used by enhanced sphere tracing. 0 means an exact distance, with a bound of 1.
+// The last is left blank
 
 void TerrainDistanceRaymarch::CSGAddSphere(ofVec3f Position, float Radius)
 {
@@ -149,4 +365,12 @@ void TerrainDistanceRaymarch::CSGRemoveSphere(ofVec3f Position, float Radius)
 
 TerrainDistanceRaymarch::~TerrainDistanceRaymarch()
 {
+	// The framebuffers are this terrain's own; the shaders are shared, and aren't its to delete.
+	delete RaymarchFramebuffer;
+	delete HistoryFramebuffer;
+	delete CheckerboardFramebuffer;
+	delete PeripheryFramebuffer;
+	delete ResolveFramebuffer;
+	delete ConePrepassFramebuffer;
+	delete ShadowMapFramebuffer;
 }
@@ -1,5 +1,8 @@
 #pragma once
 #include "Terrain.h"
+#include "NoiseVolume.h"
+#include "ShaderCache.h"
+#include "DensityField.h"
 
 //Filename: TerrainDistanceRaymarch.h
 //Version: 1.0
@@ -18,23 +21,75 @@ class TerrainDistanceRaymarch : public Terrain
 {
 	public:
 
+		// How many pixels are marched each frame. Checkerboard marches alternate halves of the screen into a half-width target, and foveated marches
+		// the periphery into a quarter-resolution target; a resolve pass rebuilds the full screen from them.
+		enum RENDER_RATE{ RATE_FULL, RATE_CHECKERBOARD, RATE_FOVEATED };
+
 		// Resolution of texture
 		int RaymarchResX = 1280;
 		int RaymarchResY = 720;
 		float maximumDepth = 1500.0f;
 		int numIterations = 256;
 
+		// Sphere tracing settings. Enhanced sphere tracing over-relaxes each step by Relaxation, falling back if it overshoots,
+		// and relies on TerrainLipschitz (and the per-operation bounds in the CSG table) to keep steps safe.
+		bool EnhancedSphereTracing = true;
+		float Relaxation = 1.6f;
+		float TerrainLipschitz = DensityField::TerrainLipschitz;
+		bool ShowStepHeatmap = false;
+
 		float accum;
 
-		// Framebuffer to store texture
+		// Framebuffer to store texture. It has a second attachment holding the hit distance of each ray.
 		ofFbo* RaymarchFramebuffer;
 
+		// Temporal reprojection: last frame's framebuffer is kept as history, and its hit distances are reprojected to give each ray a starting distance.
+		// The two framebuffers swap every frame.
+		ofFbo* HistoryFramebuffer;
+		bool TemporalReprojection = true;
+		bool historyValid = false;
+		ofVec3f previousCameraPosition;
+		ofVec3f previousCameraUpVector;
+		ofVec3f previousCameraLookTarget;
+		ofVec2f previousResolution;
+		int historyCsgRevision = -1;
+
+		// Reduced-rate rendering. Checkerboard frames are marched into CheckerboardFramebuffer. Foveated frames march the fovea into RaymarchFramebuffer,
+		// and the rest of the screen into PeripheryFramebuffer. The resolve pass rebuilds the screen from those into ResolveFramebuffer,
+		// which then becomes the history.
+		RENDER_RATE RenderRate = RATE_FULL;
+		float FoveaRadius = 0.35f;
+		ofFbo* CheckerboardFramebuffer;
+		ofFbo* PeripheryFramebuffer;
+		ofFbo* ResolveFramebuffer;
+		ofShader* ResolveShader;
+
+		// Shadows. Marched shadow rays are capped at ShadowSteps steps. With the shadow map on, the sun's visibility is instead read from a low-resolution
+		// light-space map of the terrain, which is only re-rendered when the terrain is edited or the camera strays too far from its centre.
+		// Direction towards the sun, shared by the lighting, the shadows, the shadow map and the fog.
+		ofVec3f SunDirection = ofVec3f(1.0f, 1.0f, 0.0f).getNormalized();
+
+		int ShadowSteps = 64;
+		bool ShadowMapEnabled = false;
+		float ShadowMapExtent = 2000.0f;
+		float ShadowMapHeight = 1000.0f;
+		static const int ShadowMapResolution = 512;
+		ofFbo* ShadowMapFramebuffer;
+		bool shadowMapValid = false;
+		ofVec3f shadowMapCentre;
+		int shadowMapCsgRevision = -1;
+
+		void RenderShadowMap();
+
+		// Low-resolution cone-marching prepass. Each of its pixels covers a ConePrepassScale-wide block of the full render, and holds the distance
+		// that the rays in that block can safely start marching from.
+		ofFbo* ConePrepassFramebuffer;
+		bool ConePrepass = true;
+		static const int ConePrepassScale = 8;
+
 		// Shader 
 		ofShader* RaymarchShader;
 
-		// Noise Texture
-		ofImage* noiseTex;
-
 
 		// Camera Ref
 		ofCamera* CurrentCamera;
@@ -46,6 +101,8 @@ class TerrainDistanceRaymarch : public Terrain
 		~TerrainDistanceRaymarch();
 		void Rebuild(int newX, int newY);
 		void Draw();
+		void SetRaymarchUniforms();
+		void MarchInto(ofFbo* target, int marchLayout, ofRectangle area);
 
 		void CSGAddSphere(ofVec3f Position, float Radius);
 		void CSGRemoveSphere(ofVec3f Position, float Radius);
@@ -4,32 +4,40 @@
 
 TerrainGridMarchingCubes::TerrainGridMarchingCubes()
 {
-	theGrid = new of3dPrimitive();
-	theGrid->setUseVbo(true);
+	theGrid = new ofNode();
 
-	theShader = new ofShader();
+	// Core profiles won't draw without a vertex array bound, even if nothing's read from it.
+	glGenVertexArrays(1, &emptyVao);
 
 	physOffset = ofVec3f(0, 0, 0);
 
-	// Load shader files
-	theShader->setGeometryInputType(GL_POINTS);
-	theShader->setGeometryOutputCount(16);
-	theShader->setGeometryOutputType(GL_TRIANGLE_STRIP);
+	// Fetch the shader programs. They're compiled the first time any grid terrain asks for them, and shared after that.
+	theShader = ShaderCache::Load("data/shaders/grid_marching_cubes.vert", "data/shaders/grid_marching_cubes.geom", "data/shaders/grid_marching_cubes.frag",
+		GL_POINTS, GL_TRIANGLE_STRIP, 40, { "vertexPosition" });
 
-	// Manual Shader Setup
-	theShader->setupShaderFromFile(GL_VERTEX_SHADER, "data/shaders/grid_marching_cubes.vert");
-	theShader->setupShaderFromFile(GL_GEOMETRY_SHADER, "data/shaders/grid_marching_cubes.geom");
-	theShader->setupShaderFromFile(GL_FRAGMENT_SHADER, "data/shaders/grid_marching_cubes.frag");
-	
-	// Set Feedback Parameters
-	const GLchar* feedbackVaryings[] = { "vertexPosition" };
-	glTransformFeedbackVaryings(theShader->getProgram(), 1, feedbackVaryings, GL_INTERLEAVED_ATTRIBS);
-	theShader->linkProgram();
+	// The classification pass shares the vertex shader, but streams out points (active cells) rather than triangles.
+	classifyShader = ShaderCache::Load("data/shaders/grid_marching_cubes.vert", "data/shaders/grid_classify.geom", "",
+		GL_POINTS, GL_POINTS, BlockSize * BlockSize * BlockSize, { "activeCellPosition" });
+
+	// The density pass is a plain full-screen pass, drawn once for each slice of the lattice.
+	densityShader = ShaderCache::Load("data/shaders/render_density.vert", "data/shaders/render_density.frag");
+
+	// The lattice density caches are created to fit the grid in Rebuild.
+	glGenFramebuffers(1, &densityFramebuffer);
+
+	// Assign the active cell buffer; this is written by the classification pass and then drawn as the input to the marching cubes pass.
+	activeCellBuffer = new ofBufferObject();
+	activeCellBuffer->allocate();
+	activeCellBuffer->setData(sizeof(float) * 3 * XDimension*YDimension*ZDimension, NULL, GL_DYNAMIC_COPY);
+
+	activeCellVbo = new ofVbo();
+	activeCellVbo->setVertexBuffer(*activeCellBuffer, 3, sizeof(float) * 3);
+	numActiveCells = 0;
 
 	// Assign feedback buffer
 	outputBuffer = new ofBufferObject();
 	outputBuffer->allocate();
-	outputBuffer->setData(sizeof(float) * 15 * 3 * XDimension*YDimension*ZDimension, NULL, GL_DYNAMIC_DRAW);
+	ResizeFeedbackBuffer(EstimateFeedbackTriangles());
 
 	// Assign output buffer to feedback
 	glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, outputBuffer->getId());
@@ -39,34 +47,23 @@ TerrainGridMarchingCubes::TerrainGridMarchingCubes()
 	CSGAddSphere(ofVec3f(0, 0, 0), 10);
 	
 
-	csgBuffer = new ofBufferObject();
-	csgBuffer->allocate();
-	csgBuffer->bind(GL_TEXTURE_BUFFER);
-	csgBuffer->setData(csgOperations, GL_STREAM_DRAW);
+	csgTable = SharedCSGTable();
 
-	csgTable = new ofTexture();
-	csgTable->allocateAsBufferTexture(*csgBuffer, GL_R32F);
-	csgTable->setTextureMinMagFilter(GL_NEAREST, GL_NEAREST);
+	// The triangle table is the same for every grid terrain.
+	triangleTable = SharedTriangleTable();
 
-	// Create triangle table.
-	triangleBuffer = new ofBufferObject();
-	triangleBuffer->allocate();
-	triangleBuffer->bind(GL_TEXTURE_BUFFER);
-	triangleBuffer->setData(triTableV, GL_STREAM_DRAW);
-	
-	triangleTable = new ofTexture();
-	triangleTable->allocateAsBufferTexture(*triangleBuffer, GL_R32F);
-	triangleTable->setTextureMinMagFilter(GL_NEAREST, GL_NEAREST);
-	
 	
 	theShader->begin();
 	theShader->setUniformTexture("tritabletex", *triangleTable, 0);
-	theShader->setUniformTexture("csgtex", *csgTable, 1);
 	theShader->end();
 
-	
+	densityShader->begin();
+	densityShader->setUniformTexture("csgtex", *csgTable, 1);
+	densityShader->end();
 	
 	glGenQueries(1, &feedbackQuery);
+	glGenQueries(1, &generatedQuery);
+	glGenQueries(1, &classifyQuery);
 
 	Rebuild();
 }
@@ -76,15 +73,44 @@ TerrainGridMarchingCubes::~TerrainGridMarchingCubes()
 {
 	// Clean up various things
 	delete theGrid;
-	delete theShader;
-	delete triangleBuffer;
-	delete csgBuffer;
+	glDeleteVertexArrays(1, &emptyVao);
+	// The shaders and the triangle table are shared, and aren't this terrain's to delete.
 	delete outputBuffer;
+	delete activeCellVbo;
+	delete activeCellBuffer;
+
+	glDeleteQueries(1, &feedbackQuery);
+	glDeleteQueries(1, &generatedQuery);
+	glDeleteQueries(1, &classifyQuery);
+	glDeleteFramebuffers(1, &densityFramebuffer);
+	glDeleteTextures(densityTextures.size(), densityTextures.data());
+
+	ClearHeightfieldTiles();
+}
+
+ofTexture* TerrainGridMarchingCubes::SharedTriangleTable()
+{
+	static ofTexture* sharedTable = 0;
+
+	if (sharedTable == 0)
+	{
+		// The buffer backs the texture, so it lives as long as the table does.
+		ofBufferObject* tableBuffer = new ofBufferObject();
+		tableBuffer->allocate();
+		tableBuffer->bind(GL_TEXTURE_BUFFER);
+		tableBuffer->setData(triTableV, GL_STATIC_DRAW);
+
+		sharedTable = new ofTexture();
+		sharedTable->allocateAsBufferTexture(*tableBuffer, GL_R32F);
+		sharedTable->setTextureMinMagFilter(GL_NEAREST, GL_NEAREST);
+	}
+
+	return sharedTable;
 }
 
 void TerrainGridMarchingCubes::Update()
 {
-	theGrid->setPosition(OffsetPosition + ofVec3f(-PointScale * XDimension/2, -PointScale*YDimension/2, -PointScale*ZDimension/2));
+	theGrid->setPosition(GetShellPosition(0));
 	time += (float)ofGetLastFrameTime();
 }
 
@@ -99,55 +125,53 @@ void TerrainGridMarchingCubes::Draw()
 	{
 		glDisable(GL_RASTERIZER_DISCARD);
 	}
-	// The drawVertices function draws the vertices in order, and I'm rendering them as GL_POINT type.
-	theGrid->getMeshPtr()->setMode(OF_PRIMITIVE_POINTS);
+	// Any change to the csg operations means every cached density might be wrong.
+	if (csgRevision != cachedCsgRevision)
+	{
+		cachedCsgRevision = csgRevision;
+		densityCacheValid.assign(numShells, false);
+	}
 
-	// Update csg operations table
-	csgBuffer->setData(csgOperations, GL_STREAM_DRAW);
-	
-	// Draw using shader.
-	theShader->begin();
-		theShader->setUniform1f("gridscale", PointScale);
-		theShader->setUniform3f("gridoffset", (theGrid->getPosition()));
-		theShader->setUniform1f("isolevel", 0.1f);
-		theShader->setUniform1f("expensiveNormals", expensiveNormals);
-		theShader->setUniform1f("time", time);
-		theShader->setUniform1f("numberOfCSG", csgOperations.size() / 8);
-		theShader->setUniformTexture("csgtex", *csgTable, 1);
+	// A physics mesh is only fed back if one's been asked for, and this terrain is building them.
+	bool buildPhysics = updatePhysicsMesh && BuildPhysicsMesh;
 
-		if (updatePhysicsMesh)
-		{
-			glBeginQuery(GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN, feedbackQuery); // <- this line instructs openGL to record how many triangles come back from the geometry shader.
-			glBeginTransformFeedback(GL_TRIANGLES);
-			
-			theGrid->draw();
-		
-			
-			glEndTransformFeedback();
-			glEndQuery(GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN);
-		}
-		else
+	// Draw the shells from the finest outwards. Only the finest shell is needed for physics, so it's the only one that feeds back.
+	for (int shell = 0; shell < numShells; shell++)
+	{
+		DrawShell(shell, buildPhysics && shell == 0);
+	}
+
+	// Check to see if we need to update the current mesh.
+	GLuint numTriangles = 0;
+	if (buildPhysics)
+	{
+		glGetQueryObjectuiv(feedbackQuery, GL_QUERY_RESULT, &numTriangles);
+
+		// If the geometry shader made more triangles than fit, grow the buffer to fit them all (and then some, so it isn't grown again
+		// next frame by a slightly bigger surface), and do the physics pass again, without drawing anything this time.
+		GLuint numGenerated;
+		glGetQueryObjectuiv(generatedQuery, GL_QUERY_RESULT, &numGenerated);
+		if (numGenerated > numTriangles)
 		{
-			
-			theGrid->draw();
+			std::cout << "Grid terrain feedback buffer overflowed (" << numGenerated << " triangles, room for " << feedbackCapacity << "); growing." << std::endl;
+			ResizeFeedbackBuffer(std::max(feedbackCapacity * 2, numGenerated + (numGenerated / 4)));
+
+			bool wasPhysicsOnly = PhysicsOnly;
+			PhysicsOnly = true;
+			DrawShell(0, true);
+			PhysicsOnly = wasPhysicsOnly;
+			glGetQueryObjectuiv(feedbackQuery, GL_QUERY_RESULT, &numTriangles);
 		}
+	}
 
-		
-		
-
-	theShader->end();
+	// Put the grid back where Update left it.
+	theGrid->setPosition(GetShellPosition(0));
 
 	glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, outputBuffer->getId());
 
-	// Check to see if we need to update the current mesh.
-	if (updatePhysicsMesh)
+	if (buildPhysics)
 	{
 		// For this operation, we need to fetch the data back from the GPU.
-
-		// We need to know how many vertices to store.
-		GLuint numTriangles;
-		glGetQueryObjectuiv(feedbackQuery, GL_QUERY_RESULT, &numTriangles);
-		
 		if (numTriangles < 1)
 		{
 			glDisable(GL_RASTERIZER_DISCARD);
@@ -175,8 +199,49 @@ void TerrainGridMarchingCubes::Draw()
 				newPhysicsMesh.addIndex(i);
 			
 		}
-		
-		
+
+		// Every vertex comes out of the feedback buffer once per triangle that uses it; welding them shares them between triangles, which
+		// shrinks the mesh Bullet has to build its BVH over and gives it connected triangles to collide against.
+		WeldMeshVertices(&newPhysicsMesh, PointScale * 0.01f);
+
+		// Tiles that can be heightfields get their own colliders, and the trimesh only keeps the triangles that lie in the rest.
+		// A triangle straddling the edge of a trimesh tile is kept, so that there's no gap along the seam.
+		if (HeightfieldColliders)
+		{
+			std::vector<bool> heightfieldTile = UpdateHeightfieldTiles(thePhysicsWorld);
+
+			int tilesX = (XDimension + HeightfieldTileSize - 1) / HeightfieldTileSize;
+			int tilesZ = (ZDimension + HeightfieldTileSize - 1) / HeightfieldTileSize;
+			float tileWidth = PointScale * HeightfieldTileSize;
+			ofVec3f latticeMin = GetShellLatticeOrigin(0) * PointScale;
+
+			std::vector<ofIndexType> keptIndices;
+			const std::vector<ofIndexType>& indices = newPhysicsMesh.getIndices();
+			for (int i = 0; i + 2 < indices.size(); i += 3)
+			{
+				bool keep = false;
+				for (int corner = 0; corner < 3 && !keep; corner++)
+				{
+					ofVec3f vertex = newPhysicsMesh.getVertex(indices[i + corner]);
+					int tileX = (int)ofClamp((int)floor((vertex.x - latticeMin.x) / tileWidth), 0, tilesX - 1);
+					int tileZ = (int)ofClamp((int)floor((vertex.z - latticeMin.z) / tileWidth), 0, tilesZ - 1);
+					keep = !heightfieldTile[tileX + (tilesX * tileZ)];
+				}
+
+				if (keep)
+				{
+					keptIndices.push_back(indices[i]);
+					keptIndices.push_back(indices[i + 1]);
+					keptIndices.push_back(indices[i + 2]);
+				}
+			}
+			newPhysicsMesh.clearIndices();
+			newPhysicsMesh.addIndices(keptIndices);
+		}
+		else
+		{
+			ClearHeightfieldTiles();
+		}
 
 		UpdatePhysicsMesh(thePhysicsWorld, &newPhysicsMesh);
 		
@@ -192,6 +257,205 @@ void TerrainGridMarchingCubes::Draw()
 
 }
 
+void TerrainGridMarchingCubes::DrawShell(int shell, bool feedback)
+{
+	theGrid->setPosition(GetShellPosition(shell));
+
+	// Evaluate the density function once for every lattice point.
+	CacheDensities(shell);
+
+	// Find out which cells actually need polygonising.
+	if (EmptySpaceSkipping)
+	{
+		ClassifyBlocks(shell);
+	}
+
+	// Make sure the marching cubes pass feeds back into the physics buffer, not the active cell list.
+	glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, outputBuffer->getId());
+
+	// Draw using shader.
+	theShader->begin();
+		SetShellUniforms(theShader, shell);
+		theShader->setUniform1f("isolevel", IsoLevel);
+		theShader->setUniform1f("expensiveNormals", expensiveNormals);
+		theShader->setUniform1f("time", time);
+		theShader->setUniformTexture("denstex", GL_TEXTURE_3D, densityTextures[shell], 2);
+
+		// Cells on the boundary between two shells hang skirts into the solid, to cover the gaps between the two surfaces.
+		theShader->setUniform1i("stitchBoundary", (shell < numShells - 1) ? 1 : 0);
+		theShader->setUniform3f("gridDimensions", ofVec3f(XDimension, YDimension, ZDimension));
+
+		if (feedback)
+		{
+			glBeginQuery(GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN, feedbackQuery); // <- this line instructs openGL to record how many triangles come back from the geometry shader.
+			glBeginQuery(GL_PRIMITIVES_GENERATED, generatedQuery); // <- and this one, how many it made, whether they fit or not.
+			glBeginTransformFeedback(GL_TRIANGLES);
+
+			DrawCells(shell);
+
+			glEndTransformFeedback();
+			glEndQuery(GL_PRIMITIVES_GENERATED);
+			glEndQuery(GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN);
+		}
+		else
+		{
+			DrawCells(shell);
+		}
+	theShader->end();
+}
+
+GLuint TerrainGridMarchingCubes::WorstCaseFeedbackTriangles()
+{
+	// Five triangles in every cell. When the finest shell is stitched to the next, each cell face on the edge of the grid can also hang two skirt quads.
+	GLuint worstCase = 5 * XDimension * YDimension * ZDimension;
+	if (numShells > 1)
+	{
+		worstCase += 4 * 2 * ((XDimension * YDimension) + (YDimension * ZDimension) + (XDimension * ZDimension));
+	}
+	return worstCase;
+}
+
+GLuint TerrainGridMarchingCubes::EstimateFeedbackTriangles()
+{
+	// Never more than the worst case.
+	double estimate = FeedbackTrianglesPerColumn * XDimension * ZDimension;
+	return (GLuint)std::max(1.0, std::min(estimate, (double)WorstCaseFeedbackTriangles()));
+}
+
+void TerrainGridMarchingCubes::ResizeFeedbackBuffer(GLuint triangles)
+{
+	// Three vertices to a triangle, each a vec3.
+	feedbackCapacity = std::min(triangles, WorstCaseFeedbackTriangles());
+	outputBuffer->setData(sizeof(float) * 3 * 3 * feedbackCapacity, NULL, GL_DYNAMIC_DRAW);
+}
+
+void TerrainGridMarchingCubes::CacheDensities(int shell)
+{
+	// This pass has to rasterize, even if the terrain itself is physics-only.
+	glDisable(GL_RASTERIZER_DISCARD);
+
+	int latticeX = XDimension + 1;
+	int latticeY = YDimension + 1;
+	int latticeZ = ZDimension + 1;
+
+	// Render straight into the density texture, one slice at a time; each fragment is a lattice point.
+	glBindFramebuffer(GL_FRAMEBUFFER, densityFramebuffer);
+	ofPushView();
+	ofPushStyle();
+	ofDisableAlphaBlending();
+	ofViewport(0, 0, latticeX, latticeY, false);
+	ofSetupScreenOrtho(latticeX, latticeY);
+
+	densityShader->begin();
+		densityShader->setUniform1f("gridscale", GetShellScale(shell));
+		densityShader->setUniform3f("gridoffset", (theGrid->getPosition()));
+		densityShader->setUniform3f("latticeMax", ofVec3f(XDimension, YDimension, ZDimension));
+		// Every shell but the last is surrounded by a coarser one, and its boundary has to agree with that shell's lattice.
+		densityShader->setUniform1i("stitchBoundary", (shell < numShells - 1) ? 1 : 0);
+
+		ofVec3f latticeOrigin = GetShellLatticeOrigin(shell);
+		ofVec3f wrapOrigin = GetShellLatticeWrapOrigin(shell);
+		densityShader->setUniform3i("latticeOrigin", (int)latticeOrigin.x, (int)latticeOrigin.y, (int)latticeOrigin.z);
+		densityShader->setUniform3i("latticeWrapOrigin", (int)wrapOrigin.x, (int)wrapOrigin.y, (int)wrapOrigin.z);
+		densityShader->setUniform3i("previousLatticeOrigin", (int)cachedLatticeOrigins[shell].x, (int)cachedLatticeOrigins[shell].y, (int)cachedLatticeOrigins[shell].z);
+		densityShader->setUniform1i("cacheValid", densityCacheValid[shell] ? 1 : 0);
+		densityShader->setUniform1f("numberOfCSG", csgOperations.size() / 8);
+		densityShader->setUniformTexture("csgtex", *csgTable, 1);
+		NoiseVolume::Shared()->Bind(densityShader, 3);
+
+		for (int slice = 0; slice < latticeZ; slice++)
+		{
+			glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, densityTextures[shell], 0, slice);
+			densityShader->setUniform1i("densitySlice", slice);
+			ofDrawRectangle(0, 0, latticeX, latticeY);
+		}
+	densityShader->end();
+
+	cachedLatticeOrigins[shell] = latticeOrigin;
+	densityCacheValid[shell] = true;
+
+	ofPopStyle();
+	ofPopView();
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	if (PhysicsOnly)
+	{
+		glEnable(GL_RASTERIZER_DISCARD);
+	}
+}
+
+void TerrainGridMarchingCubes::ClassifyBlocks(int shell)
+{
+	// Nothing from this pass needs to reach the screen.
+	glEnable(GL_RASTERIZER_DISCARD);
+
+	glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, activeCellBuffer->getId());
+
+	classifyShader->begin();
+		SetShellUniforms(classifyShader, shell);
+		classifyShader->setUniform1f("positionScale", GetShellScale(shell) / PointScale);
+		classifyShader->setUniform3f("gridDimensions", ofVec3f(XDimension, YDimension, ZDimension));
+		classifyShader->setUniform1f("isolevel", IsoLevel);
+		classifyShader->setUniformTexture("denstex", GL_TEXTURE_3D, densityTextures[shell], 2);
+
+		glBeginQuery(GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN, classifyQuery);
+		glBeginTransformFeedback(GL_POINTS);
+
+		// One point per block, at the centre of the block's first cell.
+		theGrid->transformGL();
+		DrawGeneratedGrid(classifyShader, (XDimension + BlockSize - 1) / BlockSize, (YDimension + BlockSize - 1) / BlockSize, (ZDimension + BlockSize - 1) / BlockSize,
+			PointScale * BlockSize);
+		theGrid->restoreTransformGL();
+
+		glEndTransformFeedback();
+		glEndQuery(GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN);
+	classifyShader->end();
+
+	// The marching cubes pass needs to know how many cells to draw. This waits on the classification pass, but it's a small one.
+	glGetQueryObjectuiv(classifyQuery, GL_QUERY_RESULT, &numActiveCells);
+
+	if (!PhysicsOnly)
+	{
+		glDisable(GL_RASTERIZER_DISCARD);
+	}
+}
+
+void TerrainGridMarchingCubes::DrawCells(int shell)
+{
+	if (!EmptySpaceSkipping)
+	{
+		// Every cell in the grid. The grid's vertices are spaced for the finest shell, so they're stretched out to fit this one.
+		theShader->setUniform1f("positionScale", GetShellScale(shell) / PointScale);
+		theGrid->transformGL();
+		DrawGeneratedGrid(theShader, XDimension, YDimension, ZDimension, PointScale);
+		theGrid->restoreTransformGL();
+		return;
+	}
+
+	// Only the cells the classification pass kept. These are in grid space, already at this shell's spacing, so only the grid's transform applies.
+	if (numActiveCells > 0)
+	{
+		theShader->setUniform1f("positionScale", 1.0f);
+		theGrid->transformGL();
+		activeCellVbo->draw(GL_POINTS, 0, numActiveCells);
+		theGrid->restoreTransformGL();
+	}
+}
+
+void TerrainGridMarchingCubes::DrawGeneratedGrid(ofShader* shader, int sizeX, int sizeY, int sizeZ, float spacing)
+{
+	shader->setUniform1f("generatedGrid", 1.0f);
+	shader->setUniform3f("generatedGridSize", ofVec3f(sizeX, sizeY, sizeZ));
+	shader->setUniform1f("generatedGridSpacing", spacing);
+
+	glBindVertexArray(emptyVao);
+	glDrawArrays(GL_POINTS, 0, sizeX * sizeY * sizeZ);
+	glBindVertexArray(0);
+
+	// The active cell list is drawn through the same shader, from real vertices.
+	shader->setUniform1f("generatedGrid", 0.0f);
+}
+
 void TerrainGridMarchingCubes::Rebuild(int newX, int newY, int newZ, float newScale)
 {
 	XDimension = newX;
@@ -199,37 +463,179 @@ void TerrainGridMarchingCubes::Rebuild(int newX, int newY, int newZ, float newSc
 	ZDimension = newZ;
 	PointScale = newScale;
 
+	NumLODShells = (int)ofClamp(NumLODShells, 1, MaxLODShells);
+	numShells = NumLODShells;
+	if (numShells > 1)
+	{
+		// With more than one shell, the dimensions have to be even, so that each shell's boundary falls on whole cells of the next shell out.
+		XDimension += XDimension % 2;
+		YDimension += YDimension % 2;
+		ZDimension += ZDimension % 2;
+	}
 
-	// Build an X*Y*Z grid of vertices.
-	theGrid->getMeshPtr()->clear();
-	for (int i = 0; i < XDimension; i++)
+
+	// There's no grid to build: the points are made in the vertex shader, from the dimensions.
+
+	updatePhysicsMesh = true;
+
+	ResizeFeedbackBuffer(EstimateFeedbackTriangles());
+
+	// Create a lattice density cache for each shell. The lattice has one more point than there are cells along each axis.
+	glDeleteTextures(densityTextures.size(), densityTextures.data());
+	densityTextures.assign(numShells, 0);
+	glGenTextures(numShells, densityTextures.data());
+	for (int shell = 0; shell < numShells; shell++)
 	{
-		for (int j = 0; j < YDimension; j++)
+		glBindTexture(GL_TEXTURE_3D, densityTextures[shell]);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+		glTexImage3D(GL_TEXTURE_3D, 0, GL_R32F, XDimension + 1, YDimension + 1, ZDimension + 1, 0, GL_RED, GL_FLOAT, NULL);
+	}
+	glBindTexture(GL_TEXTURE_3D, 0);
+
+	// The new caches hold nothing yet.
+	cachedLatticeOrigins.assign(numShells, ofVec3f(0, 0, 0));
+	densityCacheValid.assign(numShells, false);
+
+	// Blocks can overhang the edge of the grid, but only cells inside the grid are written.
+	activeCellBuffer->setData(sizeof(float) * 3 * XDimension*YDimension*ZDimension, NULL, GL_DYNAMIC_COPY);
+	activeCellVbo->setVertexBuffer(*activeCellBuffer, 3, sizeof(float) * 3);
+
+}
+
+float TerrainGridMarchingCubes::CheckDensityParity()
+{
+	if (densityCacheValid.empty() || !densityCacheValid[0] || cachedCsgRevision != csgRevision)
+	{
+		return 0.0f;
+	}
+
+	int latticeX = XDimension + 1;
+	int latticeY = YDimension + 1;
+	int latticeZ = ZDimension + 1;
+
+	std::vector<float> cachedDensities(latticeX * latticeY * latticeZ);
+	glBindTexture(GL_TEXTURE_3D, densityTextures[0]);
+	glGetTexImage(GL_TEXTURE_3D, 0, GL_RED, GL_FLOAT, cachedDensities.data());
+	glBindTexture(GL_TEXTURE_3D, 0);
+
+	// Compare against the lattice the cache was last filled with.
+	ofVec3f latticeOrigin = cachedLatticeOrigins[0];
+	float scale = GetShellScale(0);
+	bool stitched = numShells > 1;
+
+	float maxError = 0.0f;
+	for (int z = 0; z < latticeZ; z++)
+	{
+		for (int y = 0; y < latticeY; y++)
 		{
-			for (int k = 0; k < ZDimension; k++)
+			for (int x = 0; x < latticeX; x++)
 			{
-				ofVec3f newVertex = ofVec3f(((float)i * PointScale), ((float)j * PointScale), ((float)k * PointScale));
-				theGrid->getMeshPtr()->addVertex(newVertex);
-				theGrid->getMeshPtr()->addColor(ofColor::red);
+				// Undo the toroidal addressing to find which lattice point this texel holds.
+				int pointX = (((x - (int)latticeOrigin.x) % latticeX) + latticeX) % latticeX;
+				int pointY = (((y - (int)latticeOrigin.y) % latticeY) + latticeY) % latticeY;
+				int pointZ = (((z - (int)latticeOrigin.z) % latticeZ) + latticeZ) % latticeZ;
+
+				bool onBoundary = pointX == 0 || pointY == 0 || pointZ == 0 || pointX == XDimension || pointY == YDimension || pointZ == ZDimension;
+				if (stitched && onBoundary)
+				{
+					continue;
+				}
+
+				ofVec3f worldPosition = (latticeOrigin + ofVec3f(pointX, pointY, pointZ)) * scale;
+				float cpuDensity = DensityField::DistanceField(worldPosition, csgOperations).x;
+				float gpuDensity = cachedDensities[x + (latticeX * (y + (latticeY * z)))];
+
+				maxError = std::max(maxError, fabs(cpuDensity - gpuDensity));
 			}
 		}
 	}
-	
-	updatePhysicsMesh = true;
 
-	outputBuffer->setData(sizeof(float) * 15 * 3 * XDimension*YDimension*ZDimension, NULL, GL_DYNAMIC_DRAW);
+	return maxError;
+}
+
+float TerrainGridMarchingCubes::GetShellScale(int shell)
+{
+	return PointScale * (float)(1 << shell);
+}
+
+ofVec3f TerrainGridMarchingCubes::GetShellPosition(int shell)
+{
+	// Each shell is centred on the camera.
+	float scale = GetShellScale(shell);
+	ofVec3f position = OffsetPosition + ofVec3f(-scale * XDimension / 2, -scale * YDimension / 2, -scale * ZDimension / 2);
+
+	// Snap the shell's first lattice point to a whole multiple of its cell size, so that the lattice stays fixed in the world as the camera moves,
+	// rather than every sample point sliding along with it. The surface doesn't swim, and the cached densities stay valid.
+	// With more than one shell, snap to the next shell's cell size instead. This keeps every shell's lattice lined up with the one outside it,
+	// so that the boundary between them falls on shared lattice points.
+	float snap = (numShells > 1) ? scale * 2.0f : scale;
+	ofVec3f latticeOrigin = position - ofVec3f(scale * 0.5f, scale * 0.5f, scale * 0.5f);
+	latticeOrigin.x = floor(latticeOrigin.x / snap) * snap;
+	latticeOrigin.y = floor(latticeOrigin.y / snap) * snap;
+	latticeOrigin.z = floor(latticeOrigin.z / snap) * snap;
+	position = latticeOrigin + ofVec3f(scale * 0.5f, scale * 0.5f, scale * 0.5f);
+
+	return position;
+}
+
+ofVec3f TerrainGridMarchingCubes::GetShellLatticeOrigin(int shell)
+{
+	// The world-space lattice index of the shell's first lattice point. The shell is snapped, so this is always a whole number.
+	float scale = GetShellScale(shell);
+	ofVec3f latticeOrigin = (GetShellPosition(shell) / scale) - ofVec3f(0.5f, 0.5f, 0.5f);
 
+	return ofVec3f(floor(latticeOrigin.x + 0.5f), floor(latticeOrigin.y + 0.5f), floor(latticeOrigin.z + 0.5f));
+}
+
+ofVec3f TerrainGridMarchingCubes::GetShellLatticeWrapOrigin(int shell)
+{
+	// Where the shell's first lattice point is stored in its cache. Lattice indices can be negative, so this wraps them into the positive range.
+	ofVec3f latticeOrigin = GetShellLatticeOrigin(shell);
+	int sizeX = XDimension + 1;
+	int sizeY = YDimension + 1;
+	int sizeZ = ZDimension + 1;
+
+	return ofVec3f(((int)latticeOrigin.x % sizeX + sizeX) % sizeX, ((int)latticeOrigin.y % sizeY + sizeY) % sizeY, ((int)latticeOrigin.z % sizeZ + sizeZ) % sizeZ);
+}
+
+void TerrainGridMarchingCubes::SetShellUniforms(ofShader* shader, int shell)
+{
+	shader->setUniform1f("gridscale", GetShellScale(shell));
+	shader->setUniform3f("gridoffset", GetShellPosition(shell));
+
+	ofVec3f wrapOrigin = GetShellLatticeWrapOrigin(shell);
+	shader->setUniform3i("latticeWrapOrigin", (int)wrapOrigin.x, (int)wrapOrigin.y, (int)wrapOrigin.z);
+
+	// Cells that the next shell in already covers are skipped. The inner shell's extent is the span of its lattice.
+	if (shell > 0)
+	{
+		float innerScale = GetShellScale(shell - 1);
+		ofVec3f innerMin = GetShellPosition(shell - 1) - ofVec3f(innerScale * 0.5f, innerScale * 0.5f, innerScale * 0.5f);
+		shader->setUniform1i("hasInnerShell", 1);
+		shader->setUniform3f("innerShellMin", innerMin);
+		shader->setUniform3f("innerShellMax", innerMin + (ofVec3f(XDimension, YDimension, ZDimension) * innerScale));
+	}
+	else
+	{
+		shader->setUniform1i("hasInnerShell", 0);
+	}
 }
 
 void TerrainGridMarchingCubes::SetOffset(ofVec3f newOffset)
 {
-	// Only update physics terrain if new position is a significant distance from the old one
-	if (OffsetPosition != newOffset && (physOffset - newOffset).length() > 10.0f)
+	OffsetPosition = newOffset;
+
+	// Only update physics terrain if the snapped grid has moved a significant distance; movement within a cell doesn't change the surface at all.
+	ofVec3f gridPosition = GetShellPosition(0);
+	if (physOffset != gridPosition && (physOffset - gridPosition).length() > 10.0f)
 	{
 		updatePhysicsMesh = true;
-		physOffset = newOffset;
+		physOffset = gridPosition;
 	}
-	OffsetPosition = newOffset;
 }
 
 // CSG Operations on this kind of terrain work by filling a texture buffer.
@@ -273,6 +679,13 @@ void TerrainGridMarchingCubes::UpdatePhysicsMesh(ofxBulletWorldRigid* world, ofM
 		//delete thePhysicsMesh;
 		//thePhysicsMesh = 0;
 	}
+
+	// If every tile became a heightfield, there's nothing left for the trimesh to do, and Bullet won't build a BVH over no triangles.
+	if (theMesh->getNumIndices() == 0)
+	{
+		updatePhysicsMesh = false;
+		return;
+	}
 	
 	if (thePhysicsMesh == 0)
 	{
@@ -291,4 +704,149 @@ void TerrainGridMarchingCubes::UpdatePhysicsMesh(ofxBulletWorldRigid* world, ofM
 	//thePhysicsMesh->updateMesh(world->world, *theMesh);
 
 	updatePhysicsMesh = false;
-}
\ No newline at end of file
+}
+
+std::vector<bool> TerrainGridMarchingCubes::UpdateHeightfieldTiles(ofxBulletWorldRigid* world)
+{
+	ClearHeightfieldTiles();
+
+	int tilesX = (XDimension + HeightfieldTileSize - 1) / HeightfieldTileSize;
+	int tilesZ = (ZDimension + HeightfieldTileSize - 1) / HeightfieldTileSize;
+	std::vector<bool> heightfieldTile(tilesX * tilesZ, false);
+
+	for (int tileZ = 0; tileZ < tilesZ; tileZ++)
+	{
+		for (int tileX = 0; tileX < tilesX; tileX++)
+		{
+			if (!TileTouchedByCSG(tileX, tileZ))
+			{
+				heightfieldTile[tileX + (tilesX * tileZ)] = BuildHeightfieldTile(world, tileX, tileZ);
+			}
+		}
+	}
+
+	return heightfieldTile;
+}
+
+bool TerrainGridMarchingCubes::TileTouchedByCSG(int tileX, int tileZ)
+{
+	// The tile's extent in X and Z, grown by a cell, as the marching cubes surface in a cell depends on the lattice points around it.
+	ofVec3f latticeMin = GetShellLatticeOrigin(0) * PointScale;
+	float minX = latticeMin.x + ((tileX * HeightfieldTileSize) - 1) * PointScale;
+	float minZ = latticeMin.z + ((tileZ * HeightfieldTileSize) - 1) * PointScale;
+	float maxX = latticeMin.x + ((std::min((tileX + 1) * HeightfieldTileSize, XDimension)) + 1) * PointScale;
+	float maxZ = latticeMin.z + ((std::min((tileZ + 1) * HeightfieldTileSize, ZDimension)) + 1) * PointScale;
+
+	// The first entry of the table is a placeholder, and is skipped. Only spheres are stored for now; each reaches as far as its radius in X and Z.
+	int numberOfCSG = csgOperations.size() / 8;
+	for (int i = 1; i < numberOfCSG; i++)
+	{
+		const GLfloat* operation = &csgOperations[i * 8];
+		if (operation[1] != 0)
+		{
+			continue;
+		}
+
+		float nearestX = ofClamp(operation[2], minX, maxX);
+		float nearestZ = ofClamp(operation[4], minZ, maxZ);
+		float distanceX = operation[2] - nearestX;
+		float distanceZ = operation[4] - nearestZ;
+		if ((distanceX * distanceX) + (distanceZ * distanceZ) <= operation[5] * operation[5])
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+bool TerrainGridMarchingCubes::BuildHeightfieldTile(ofxBulletWorldRigid* world, int tileX, int tileZ)
+{
+	// The tile's columns are the lattice columns the marching cubes pass samples, so neighbouring tiles share their edge columns and meet without a seam.
+	int firstX = tileX * HeightfieldTileSize;
+	int firstZ = tileZ * HeightfieldTileSize;
+	int columnsX = std::min(HeightfieldTileSize, XDimension - firstX) + 1;
+	int columnsZ = std::min(HeightfieldTileSize, ZDimension - firstZ) + 1;
+	ofVec3f latticeOrigin = GetShellLatticeOrigin(0);
+
+	// Nothing has been edited here, so only the base terrain needs evaluating.
+	std::vector<GLfloat> noOperations;
+
+	HeightfieldTile* tile = new HeightfieldTile();
+	tile->Heights.resize(columnsX * columnsZ);
+	float minHeight = FLT_MAX;
+	float maxHeight = -FLT_MAX;
+
+	for (int z = 0; z < columnsZ; z++)
+	{
+		for (int x = 0; x < columnsX; x++)
+		{
+			// Walk up the column, looking for where it crosses the surface. A heightfield needs solid at the bottom, air at the top, and exactly one crossing
+			// in between; anything else (an overhang, a cave, or a surface outside the grid) means the tile needs the trimesh.
+			int crossings = 0;
+			float height = 0.0f;
+			float below = 0.0f;
+			for (int y = 0; y <= YDimension; y++)
+			{
+				ofVec3f worldPosition = (latticeOrigin + ofVec3f(firstX + x, y, firstZ + z)) * PointScale;
+				float density = DensityField::DistanceField(worldPosition, noOperations).x;
+
+				if (y == 0 && density > IsoLevel)
+				{
+					crossings = -1;
+					break;
+				}
+				if (y > 0 && (below <= IsoLevel) != (density <= IsoLevel))
+				{
+					// Interpolate along the edge, as the marching cubes pass does.
+					crossings++;
+					height = worldPosition.y - PointScale + (PointScale * ((IsoLevel - below) / (density - below)));
+				}
+				below = density;
+			}
+
+			if (crossings != 1)
+			{
+				delete tile;
+				return false;
+			}
+
+			tile->Heights[x + (columnsX * z)] = height;
+			minHeight = std::min(minHeight, height);
+			maxHeight = std::max(maxHeight, height);
+		}
+	}
+
+	tile->Shape = new btHeightfieldTerrainShape(columnsX, columnsZ, tile->Heights.data(), 1.0f, minHeight, maxHeight, 1, PHY_FLOAT, false);
+	tile->Shape->setLocalScaling(btVector3(PointScale, 1.0f, PointScale));
+
+	// Bullet centres a heightfield on its bounding box, so the body goes in the middle of the tile, halfway between its lowest and highest points.
+	ofVec3f tileCentre = (latticeOrigin + ofVec3f(firstX + ((columnsX - 1) * 0.5f), 0.0f, firstZ + ((columnsZ - 1) * 0.5f))) * PointScale;
+	btTransform transform;
+	transform.setIdentity();
+	transform.setOrigin(btVector3(tileCentre.x, (minHeight + maxHeight) * 0.5f, tileCentre.z));
+
+	// Static, like the trimesh, so that objects can sleep on it.
+	btRigidBody::btRigidBodyConstructionInfo bodyInfo(0.0f, 0, tile->Shape);
+	bodyInfo.m_startWorldTransform = transform;
+	tile->Body = new btRigidBody(bodyInfo);
+	tile->Body->setCollisionFlags(tile->Body->getCollisionFlags() | btCollisionObject::CF_STATIC_OBJECT);
+
+	tile->World = world->world;
+	tile->World->addRigidBody(tile->Body);
+	heightfieldTiles.push_back(tile);
+
+	return true;
+}
+
+void TerrainGridMarchingCubes::ClearHeightfieldTiles()
+{
+	for (auto iter = heightfieldTiles.begin(); iter != heightfieldTiles.end(); iter++)
+	{
+		(*iter)->World->removeRigidBody((*iter)->Body);
+		delete (*iter)->Body;
+		delete (*iter)->Shape;
+		delete *iter;
+	}
+	heightfieldTiles.clear();
+}
@@ -1,7 +1,11 @@
 #pragma once
 #include "Terrain.h"
 #include "tables.h"
+#include "DensityField.h"
+#include "ShaderCache.h"
+#include "MeshCutting.h"
 #include "ofxBullet.h"
+#include "BulletCollision/CollisionShapes/btHeightfieldTerrainShape.h"
 
 //Filename: TerrainGridMarchingCubes.h
 //Version: 1.0
@@ -10,11 +14,13 @@
 //
 //Purpose: This is the header file for a grid-based Marching Cubes Terrain. 
 //
-// This will do most of its work in the geometry shader on the graphics card: this class will simply draw a 3D grid of vertices in front of the camera, moving with it. This means that
-// the world-space position of each of the points in the grid will change as the camera is moved around, and those points will become the cell centres that the marching cubes algorithm
-// will sample density around, in the geometry shader.
+// This will do most of its work in the geometry shader on the graphics card: this class will simply draw a 3D grid of vertices around the camera, and those points will become
+// the cell centres that the marching cubes algorithm will sample density around, in the geometry shader. The grid follows the camera in whole cells rather than continuously:
+// its lattice is snapped to multiples of the cell size (twice the cell size, with more than one LOD shell, so each shell lines up with the one outside it), so sample points stay
+// fixed in the world and the surface doesn't swim as the camera moves.
 //
-// This will be fairly lightweight on the CPU side; it's likely, in fact, that it won't even store very much in memory, holding only one single mesh.
+// This will be fairly lightweight on the CPU side. The grid doesn't even have any vertices: each point is drawn from an empty vertex array, and the vertex shader
+// works out where it goes from its vertex ID, so resizing the grid costs nothing but changing a draw count.
 
 // Paul Bourke's Triangle Table from his 1994 paper, Polygonizing A Scalar Field
 
@@ -29,27 +35,118 @@ class TerrainGridMarchingCubes : public Terrain
 		// For rendering
 		ofShader* theShader;
 
-		// For marching cubes, store the triangle table as a texture.
-		ofBufferObject* triangleBuffer;
+		// For caching densities: each lattice point (cell corner) is evaluated once per frame into a 3D texture, and the later passes read from it.
+		// Every LOD shell has its own lattice, and so its own texture.
+		ofShader* densityShader;
+		std::vector<GLuint> densityTextures;
+
+		// How many LOD shells the grid was last rebuilt with, and so how many density textures there are. NumLODShells only takes effect on Rebuild.
+		int numShells = 0;
+		GLuint densityFramebuffer;
+
+		// The density caches are addressed toroidally by world-space lattice index, so that when the grid moves by whole cells, only the newly exposed lattice points
+		// need evaluating. These track which lattice each shell's cache last held, and whether it's still usable; any change to the CSG operations invalidates all of them.
+		std::vector<ofVec3f> cachedLatticeOrigins;
+		std::vector<bool> densityCacheValid;
+		int cachedCsgRevision = -1;
+
+		// For empty-space skipping: blocks of cells are classified first, and only the cells of blocks that might hold the surface are polygonised.
+		ofShader* classifyShader;
+		ofBufferObject* activeCellBuffer;
+		ofVbo* activeCellVbo;
+		GLuint classifyQuery;
+		GLuint numActiveCells;
+
+		// For marching cubes, store the triangle table as a texture. It never changes, so one copy is shared by every grid terrain.
 		ofTexture* triangleTable;
+		static ofTexture* SharedTriangleTable();
 		GLuint triTableTex;
 
 
 
-		// For multipass
+		// For multipass. The feedback buffer is sized for an estimate of how many triangles the surface will make, rather than the worst case
+		// of five in every cell (plus the skirts on the edge of the grid), and grows if a physics pass overflows it.
 		ofBufferObject* outputBuffer;
+		GLuint feedbackCapacity;
+		GLuint WorstCaseFeedbackTriangles();
+		GLuint EstimateFeedbackTriangles();
+		void ResizeFeedbackBuffer(GLuint triangles);
 
-		// Feedback query
+		// Feedback queries: how many triangles made it into the feedback buffer, and how many the geometry shader made. If they differ, the buffer overflowed.
 		GLuint feedbackQuery;
+		GLuint generatedQuery;
+
+		// Heightfield colliders. The physics region is split into square tiles of cells, in X and Z; a tile that no CSG operation reaches, and whose every column of the
+		// lattice crosses the surface exactly once, is a heightfield, and gets a btHeightfieldTerrainShape sampled from DensityField rather than a share of the trimesh.
+		struct HeightfieldTile
+		{
+			std::vector<float> Heights;
+			btHeightfieldTerrainShape* Shape;
+			btRigidBody* Body;
+			btDiscreteDynamicsWorld* World;
+		};
+		std::vector<HeightfieldTile*> heightfieldTiles;
+
+		// Rebuilds the heightfield tiles for the finest shell, and returns, for each tile, whether it became a heightfield.
+		std::vector<bool> UpdateHeightfieldTiles(ofxBulletWorldRigid* world);
+		bool BuildHeightfieldTile(ofxBulletWorldRigid* world, int tileX, int tileZ);
+		bool TileTouchedByCSG(int tileX, int tileZ);
+
+		void CacheDensities(int shell);
+		void ClassifyBlocks(int shell);
+		void DrawCells(int shell);
+
+		// Caches, classifies and polygonises one shell, feeding its triangles back if asked to.
+		void DrawShell(int shell, bool feedback);
+
+		// LOD shell placement. Shell 0 is the finest, and each shell after it has cells twice the size of the one before.
+		float GetShellScale(int shell);
+		ofVec3f GetShellPosition(int shell);
+		ofVec3f GetShellLatticeOrigin(int shell);
+		ofVec3f GetShellLatticeWrapOrigin(int shell);
+		void SetShellUniforms(ofShader* shader, int shell);
+
+		// The grid points, and the classification blocks, are drawn from this: a vertex array with nothing in it.
+		GLuint emptyVao;
+
+		// Draws an X*Y*Z lattice of points, spacing apart, positioned by vertex ID in grid_marching_cubes.vert.
+		void DrawGeneratedGrid(ofShader* shader, int sizeX, int sizeY, int sizeZ, float spacing);
 
 	public:
 		// Fields
-		of3dPrimitive* theGrid;
+		// Where the grid is; it has no mesh of its own.
+		ofNode* theGrid;
 		int XDimension = 16;
 		int YDimension = 16;
 		int ZDimension = 16;
 		float PointScale = 1.0f;
 		float expensiveNormals = 0.0f;
+		bool EmptySpaceSkipping = true;
+
+		// The density at which the surface lies. The marching cubes and classification passes, and the heightfield colliders, all use this.
+		float IsoLevel = 0.1f;
+
+		// Whether this terrain builds physics colliders at all. While it doesn't, requests for a new physics mesh are held until it does.
+		bool BuildPhysicsMesh = true;
+
+		// Whether unedited tiles of the physics terrain use heightfield colliders; if not, the whole physics terrain is one trimesh.
+		bool HeightfieldColliders = true;
+
+		// Side length of a heightfield tile, in cells.
+		static const int HeightfieldTileSize = 8;
+
+		// How many triangles the feedback buffer starts with room for, per column of cells. The surface crosses most columns once or twice,
+		// and each cell it crosses makes a triangle or two; this leaves some headroom over that.
+		float FeedbackTrianglesPerColumn = 6.0f;
+
+		// Number of nested LOD shells around the camera. Each shell has the same number of cells as the first, but doubles the cell size, so
+		// view distance grows without the cell count growing cubically. Where two shells meet, the cells on the boundary hang skirts into the solid
+		// to close the gaps between their surfaces. Takes effect on Rebuild.
+		int NumLODShells = 1;
+		static const int MaxLODShells = 4;
+
+		// Side length of a classification block, in cells. Must match BLOCK_SIZE in grid_classify.geom.
+		static const int BlockSize = 4;
 		float time = 0.0f;
 		bool updatePhysicsMesh = false;
 		bool PhysicsOnly = false;
@@ -64,11 +161,16 @@ class TerrainGridMarchingCubes : public Terrain
 		virtual void SetOffset(ofVec3f newOffset);
 		void CSGAddSphere(ofVec3f Position, float Radius);
 		void CSGRemoveSphere(ofVec3f Position, float Radius);
+
+		// Reads back the finest shell's density cache and compares it against DensityField on the CPU, returning the largest difference.
+		// Boundary points of a stitched shell hold interpolated densities, and are skipped.
+		float CheckDensityParity();
 		
 		ofxBulletWorldRigid* thePhysicsWorld;
 		ofxBulletTriMeshShape* thePhysicsMesh;
 		ofVec3f physOffset;
 
 		void UpdatePhysicsMesh(ofxBulletWorldRigid* world, ofMesh* theMesh);
+		void ClearHeightfieldTiles();
 };
 
@@ -50,9 +50,17 @@ void ofApp::setup()
 	// Scalar value for shader to determine if we should use smoothed normals or not on the grid terrain.
 	GridExpensiveNormals = 0.0f;
 	
-	// Make the terrain, starting off with using the GridMarchingCubes implementation.
-	theTerrain = new TerrainGridMarchingCubes();
-	((TerrainGridMarchingCubes*)theTerrain)->Rebuild(GridTerrainResolution, GridTerrainResolution, GridTerrainResolution, GridTerrainSize);
+	// Make both terrains up front, and keep them for the life of the app; switching between them is then just a matter of which one is drawn.
+	// Start off using the GridMarchingCubes implementation.
+	gridTerrain = new TerrainGridMarchingCubes();
+	gridTerrain->NumLODShells = GridLODShells;
+	gridTerrain->Rebuild(GridTerrainResolution, GridTerrainResolution, GridTerrainResolution, GridTerrainSize);
+
+	raymarchTerrain = new TerrainDistanceRaymarch();
+	raymarchTerrain->Rebuild(RayTerrainResolutionX, RayTerrainResolutionY);
+	raymarchTerrain->CurrentCamera = theCamera;
+
+	theTerrain = gridTerrain;
 	currentTerrainType = TERRAIN_TYPE::TERRAIN_GRID_MC;
 
 	// Make the physics world.
@@ -64,6 +72,9 @@ void ofApp::setup()
 	thePhysicsWorld->enableGrabbing();
 	thePhysicsWorld->setCamera(theCamera);
 
+	// The world isn't stepped on its own thread until everything's been added to it, at the end of setup.
+	physicsThread = new PhysicsThread(thePhysicsWorld);
+
 	// Create "dummy" element in the csgOperations buffer. This is necessary for it to work properly as a texture buffer for the terrains.
 	CSGAddSphere(ofVec3f(0,0,0), 0);
 
@@ -101,6 +112,17 @@ void ofApp::setup()
 	gnpLastFrameTime.DotType = 7;
 	gnpLastFrameTime.GraphStyle = 1;
 
+	gnpPhysicsDroppedSteps.Column1Name = "Frame No.";
+	gnpPhysicsDroppedSteps.Column2Name = "Dropped Physics Steps";
+	gnpPhysicsDroppedSteps.XAxisName = "Frame No.";
+	gnpPhysicsDroppedSteps.YAxisName = "Dropped Physics Steps";
+	gnpPhysicsDroppedSteps.DataColumns = 2;
+	gnpPhysicsDroppedSteps.HexColour = "aa00aa";
+	gnpPhysicsDroppedSteps.LineThickness = 1;
+	gnpPhysicsDroppedSteps.DotSize = 1;
+	gnpPhysicsDroppedSteps.DotType = 7;
+	gnpPhysicsDroppedSteps.GraphStyle = 1;
+
 	// Create mesh template for physics boxes.	
 	testBoxMesh = new ofBoxPrimitive(10, 10, 10, 1, 1, 1);
 
@@ -114,10 +136,32 @@ void ofApp::setup()
 	singleTriangle.addIndex(2);
 	thePhysicsMesh = CreatePhysicsMesh(thePhysicsWorld, &singleTriangle);
 
-	((TerrainGridMarchingCubes*)theTerrain)->updatePhysicsMesh = true;
-	
-	// Assign CSG operations buffer
-	theTerrain->csgOperations = csgOperations;
+	gridTerrain->updatePhysicsMesh = true;
+
+	// Create the density field collider. It reads the CSG operations as they stand, so it never needs rebuilding.
+	DensityFieldCollisionAlgorithm::Register((btCollisionDispatcher*)thePhysicsWorld->world->getDispatcher());
+	terrainFieldShape = new DensityFieldShape(&physicsCsgOperations, gridTerrain->IsoLevel);
+	btRigidBody::btRigidBodyConstructionInfo fieldInfo(0.0f, 0, terrainFieldShape);
+	terrainFieldBody = new btRigidBody(fieldInfo);
+	terrainFieldBody->setCollisionFlags(terrainFieldBody->getCollisionFlags() | btCollisionObject::CF_STATIC_OBJECT);
+
+	// And the on-demand triangle collider, with cells the size of the grid terrain's.
+	terrainMeshShape = new DensityFieldMeshShape(&physicsCsgOperations, &physicsCsgRevision, gridTerrain->IsoLevel, gridTerrain->PointScale);
+	btRigidBody::btRigidBodyConstructionInfo meshInfo(0.0f, 0, terrainMeshShape);
+	terrainMeshBody = new btRigidBody(meshInfo);
+	terrainMeshBody->setCollisionFlags(terrainMeshBody->getCollisionFlags() | btCollisionObject::CF_STATIC_OBJECT);
+
+	SetTerrainCollider(PhysicsTerrainCollider);
+
+	// Settled fragments are reported as they go to sleep, rather than searched for.
+	physicsThread->BodyFellAsleep = [this](const btRigidBody* body) { BodyFellAsleep(body); };
+
+	// Start stepping. Mouse grabbing reaches into the world from the main thread, so it's only allowed while the world is stepped inline.
+	if (PhysicsThreaded)
+	{
+		physicsThread->Start();
+		thePhysicsWorld->disableGrabbing();
+	}
 
 	// Add elements to GUI.
 	buildGUI();
@@ -134,11 +178,6 @@ void ofApp::update()
 	float deltaTime = ofGetLastFrameTime();
 	
 	// Update GUI
-	if (GuiNeedsRebuilt)
-	{
-		buildGUI();
-	}
-
 	auto frametimeGUI = theGUI->getTextInput("Frame-Time", "Diagnostics");
 	frametimeGUI->setText(std::to_string(deltaTime) + " s");
 	auto frametimePlot = theGUI->getValuePlotter("FT", "Diagnostics");
@@ -155,6 +194,8 @@ void ofApp::update()
 	if (currentTerrainType == TERRAIN_TYPE::TERRAIN_GRID_MC)
 	{
 		((TerrainGridMarchingCubes*)theTerrain)->expensiveNormals = GridExpensiveNormals;
+		((TerrainGridMarchingCubes*)theTerrain)->EmptySpaceSkipping = GridEmptySpaceSkipping;
+		((TerrainGridMarchingCubes*)theTerrain)->HeightfieldColliders = PhysicsHeightfieldColliders;
 		//((TerrainGridMarchingCubes*)theTerrain)->updatePhysicsMesh = physicsNeedsRebuilding;
 		((TerrainGridMarchingCubes*)theTerrain)->thePhysicsWorld = thePhysicsWorld;
 		((TerrainGridMarchingCubes*)theTerrain)->thePhysicsMesh = thePhysicsMesh;
@@ -165,21 +206,53 @@ void ofApp::update()
 		((TerrainDistanceRaymarch*)theTerrain)->maximumDepth = RayTerrainDrawDistance;
 		((TerrainDistanceRaymarch*)theTerrain)->RaymarchResX = RayTerrainResolutionX;
 		((TerrainDistanceRaymarch*)theTerrain)->RaymarchResY = RayTerrainResolutionY;
+		((TerrainDistanceRaymarch*)theTerrain)->EnhancedSphereTracing = RayEnhancedSphereTracing;
+		((TerrainDistanceRaymarch*)theTerrain)->Relaxation = RayRelaxation;
+		((TerrainDistanceRaymarch*)theTerrain)->TerrainLipschitz = RayTerrainLipschitz;
+		((TerrainDistanceRaymarch*)theTerrain)->ShowStepHeatmap = RayStepHeatmap;
+		((TerrainDistanceRaymarch*)theTerrain)->ConePrepass = RayConePrepass;
+		((TerrainDistanceRaymarch*)theTerrain)->TemporalReprojection = RayTemporalReprojection;
+		((TerrainDistanceRaymarch*)theTerrain)->RenderRate = RayRenderRate;
+		((TerrainDistanceRaymarch*)theTerrain)->FoveaRadius = RayFoveaRadius;
+		((TerrainDistanceRaymarch*)theTerrain)->ShadowSteps = RayShadowSteps;
+		((TerrainDistanceRaymarch*)theTerrain)->ShadowMapEnabled = RayShadowMap;
 	}
 
 	
 	// Update terrain
 	theTerrain->Update();
 
-	// Update physics
-	if (PhysicsEnabled)
+	// Update physics. Pick up anything the physics thread has handed back, then either let it carry on stepping, or step here if it isn't running.
+	physicsThread->RunPosted();
+	physicsThread->TimeScale = PhysicsTimescale;
+	physicsThread->FixedStep = PhysicsFixedStep / 1000.0f;
+	physicsThread->MaxSubSteps = PhysicsMaxSubSteps;
+	physicsThread->Enabled = PhysicsEnabled;
+	if (!physicsThread->IsRunning())
+	{
+		physicsThread->Step(ofGetLastFrameTime());
+	}
+	physicsThread->ReadSnapshot();
+
+	// Turn settled fragments back into terrain, a batch at a time, with one CSG upload per batch.
+	std::vector<ofVec4f> settledSpheres;
+	if (debrisConsolidator.Update(settledSpheres) && !settledSpheres.empty())
 	{
-		thePhysicsWorld->update(0.016f * (PhysicsTimescale*2), 0);
-		// every half-second check for resting bodies
-		if (ofGetElapsedTimeMillis() % 60 == 0)
+		for (auto iter = settledSpheres.begin(); iter != settledSpheres.end(); ++iter)
 		{
-			CheckBodiesAtRest();
+			CSGAddSphere(ofVec3f(iter->x, iter->y, iter->z), iter->w, false);
 		}
+		SyncCSGOperations();
+
+		// Raise GNUPlot event
+		GNUPlotEvent newEvent;
+		newEvent.xPosition = gnpUpdatePerformance.Column1.size();
+		newEvent.xRange = 5;
+		newEvent.boxColour = "ccffcc";
+		newEvent.labelName = "Mesh->Density";
+		gnpUpdatePerformance.Events.push_back(newEvent);
+		gnpDrawPerformance.Events.push_back(newEvent);
+		gnpLastFrameTime.Events.push_back(newEvent);
 	}
 
 	gnpUpdatePerformance.Column1.push_back(gnpUpdatePerformance.Column1.size());
@@ -187,6 +260,12 @@ void ofApp::update()
 
 	gnpLastFrameTime.Column1.push_back(gnpLastFrameTime.Column1.size());
 	gnpLastFrameTime.Column2.push_back(ofGetLastFrameTime() * 1000.0f);
+
+	// Steps dropped since last frame, because physics couldn't keep up.
+	int droppedSteps = physicsThread->DroppedSteps;
+	gnpPhysicsDroppedSteps.Column1.push_back(gnpPhysicsDroppedSteps.Column1.size());
+	gnpPhysicsDroppedSteps.Column2.push_back(droppedSteps - lastDroppedSteps);
+	lastDroppedSteps = droppedSteps;
 }
 
 //--------------------------------------------------------------
@@ -207,10 +286,14 @@ void ofApp::draw()
 		}
 		else
 		{
+			// Building colliders changes the world, so the physics thread has to be kept out of it until they're built.
+			std::unique_lock<std::mutex> worldLock(physicsThread->WorldMutex(), std::defer_lock);
 			if (currentTerrainType == TERRAIN_TYPE::TERRAIN_GRID_MC)
 			{
-				if (((TerrainGridMarchingCubes*)(theTerrain))->updatePhysicsMesh)
+				if (((TerrainGridMarchingCubes*)(theTerrain))->updatePhysicsMesh && ((TerrainGridMarchingCubes*)(theTerrain))->BuildPhysicsMesh)
 				{
+					worldLock.lock();
+
 					// Raise GNUPlot event
 					GNUPlotEvent newEvent;
 					newEvent.xPosition = gnpUpdatePerformance.Column1.size() + 1;
@@ -236,6 +319,7 @@ void ofApp::draw()
 		
 		if (PhysicsWireframe)
 		{
+			std::lock_guard<std::mutex> worldLock(physicsThread->WorldMutex());
 			thePhysicsWorld->drawDebug();
 		}
 		
@@ -249,10 +333,18 @@ void ofApp::draw()
 		// Draw physics objects.
 
 		
-		// Draw sliced up objects
+		// Draw sliced up objects, where the last snapshot from the physics thread puts them.
 		for (int i = 0; i < cutPhysicsObjects.size(); i++)
 		{
-			cutPhysicsObjects.at(i).second->transformGL();
+			ofMatrix4x4 transform;
+			if (!physicsThread->GetInterpolatedTransform(cutPhysicsObjects.at(i).second->getRigidBody(), transform))
+			{
+				// Not been through a step yet.
+				continue;
+			}
+
+			ofPushMatrix();
+			ofMultMatrix(transform);
 			
 			if (PhysicsWireframe)
 			{
@@ -263,7 +355,7 @@ void ofApp::draw()
 				cutPhysicsObjects.at(i).first->draw();
 			}
 			
-			cutPhysicsObjects.at(i).second->restoreTransformGL();
+			ofPopMatrix();
 		}
 
 		// stop using lights
@@ -305,26 +397,32 @@ void ofApp::draw()
 
 	
 
-	if (theCamera->getPosition() != camDelta && (theCamera->getPosition() - camDelta).length() > 40.0f)
+	bool cameraMoved = theCamera->getPosition() != camDelta && (theCamera->getPosition() - camDelta).length() > 40.0f;
+	if (cameraMoved)
 	{
 		camDelta = theCamera->getPosition();
+	}
 
+	// Colliding against the density field directly needs nothing rebuilding, whatever the camera does.
+	if (gridTerrain->BuildPhysicsMesh && (cameraMoved || physicsNeedsRebuilding))
+	{
 		if ((currentTerrainType == TERRAIN_TYPE::TERRAIN_RAY_DIST))
 		{
-			// Quickly create and render a grid terrain.
-			TerrainGridMarchingCubes* newTerrain = new TerrainGridMarchingCubes();
-			newTerrain->updatePhysicsMesh = true;
-			newTerrain->PhysicsOnly = true;
-			newTerrain->Rebuild(GridTerrainResolution, GridTerrainResolution, GridTerrainResolution, GridTerrainSize);
-			newTerrain->thePhysicsWorld = thePhysicsWorld;
-			newTerrain->thePhysicsMesh = thePhysicsMesh;
-			newTerrain->expensiveNormals = GridExpensiveNormals;
-			newTerrain->SetOffset(theCamera->getPosition());
-			newTerrain->Update();
-			newTerrain->csgOperations = csgOperations;
-			newTerrain->Draw();
-
-			delete newTerrain;
+			// Quickly render the grid terrain, without drawing it, to give physics a mesh around the camera.
+			gridTerrain->updatePhysicsMesh = true;
+			gridTerrain->PhysicsOnly = true;
+			gridTerrain->thePhysicsWorld = thePhysicsWorld;
+			gridTerrain->thePhysicsMesh = thePhysicsMesh;
+			gridTerrain->expensiveNormals = GridExpensiveNormals;
+			gridTerrain->EmptySpaceSkipping = GridEmptySpaceSkipping;
+			gridTerrain->HeightfieldColliders = PhysicsHeightfieldColliders;
+			gridTerrain->SetOffset(theCamera->getPosition());
+			gridTerrain->Update();
+			{
+				std::lock_guard<std::mutex> worldLock(physicsThread->WorldMutex());
+				gridTerrain->Draw();
+			}
+			gridTerrain->PhysicsOnly = false;
 
 			physicsNeedsRebuilding = false;
 
@@ -449,21 +547,25 @@ void ofApp::mousePressed(int x, int y, int button)
 
 			physicsNeedsRebuilding = true;
 
-			// Create Physics Sphere Object
-			ofxBulletCustomShape newSphereShape;
-			newSphereShape.create(thePhysicsWorld->getWorld(), removePos, 1.0f);
-			
-
+			// Create Physics Sphere Object, and slice it up, on the physics thread; the pieces are handed back to be drawn once they're in the world.
 			ofSpherePrimitive newSphere;
 			newSphere.setRadius(12.5f);
+			ofMesh sphereMesh = newSphere.getMesh();
 
-			newSphereShape.addMesh(newSphere.getMesh(), ofVec3f(1, 1, 1), true);
-			newSphereShape.add();
-			
-
-			// Slice up that object
-			std::vector<std::pair<ofMesh*, ofxBulletCustomShape*>> newObjects = VoronoiFracture(&newSphereShape, newSphere.getMeshPtr(), thePhysicsWorld, 16, NULL);
-			cutPhysicsObjects.insert(cutPhysicsObjects.end(), newObjects.begin(), newObjects.end());
+			physicsThread->Enqueue([this, removePos, sphereMesh]() mutable
+			{
+				ofxBulletCustomShape newSphereShape;
+				newSphereShape.create(thePhysicsWorld->getWorld(), removePos, 1.0f);
+				newSphereShape.addMesh(sphereMesh, ofVec3f(1, 1, 1), true);
+				newSphereShape.add();
+
+				// Slice up that object
+				std::vector<std::pair<ofMesh*, ofxBulletCustomShape*>> newObjects = VoronoiFracture(&newSphereShape, &sphereMesh, thePhysicsWorld, 16, NULL);
+				physicsThread->Post([this, newObjects]()
+				{
+					cutPhysicsObjects.insert(cutPhysicsObjects.end(), newObjects.begin(), newObjects.end());
+				});
+			});
 
 			CSGRemoveSphere(removePos, 25);
 			std::cout << "Removed CSG Sphere w/ Object, at " << removePos << "." << std::endl;
@@ -523,18 +625,42 @@ void ofApp::dragEvent(ofDragInfo dragInfo){
 void ofApp::onDropdownEvent(ofxDatGuiDropdownEvent e)
 {
 	auto selectedItem = e.target->getSelected();
-	if (selectedItem->getName() == "Grid-Based Naive Marching Cubes" && currentTerrainType != TERRAIN_TYPE::TERRAIN_GRID_MC)
+
+	// Terrain collider.
+	if (selectedItem->getName() == "Density Field Contacts")
 	{
-		// delete terrain, remake as grid
-		delete theTerrain;
-		theTerrain = new TerrainGridMarchingCubes();
-		((TerrainGridMarchingCubes*)theTerrain)->Rebuild(GridTerrainResolution, GridTerrainResolution, GridTerrainResolution, GridTerrainSize);
+		SetTerrainCollider(COLLIDER_FIELD_CONTACTS);
+	}
+	if (selectedItem->getName() == "On-Demand Triangles")
+	{
+		SetTerrainCollider(COLLIDER_FIELD_TRIANGLES);
+	}
+	if (selectedItem->getName() == "Grid Colliders")
+	{
+		SetTerrainCollider(COLLIDER_GRID);
+	}
 
-		currentTerrainType = TERRAIN_TYPE::TERRAIN_GRID_MC;
+	// Raymarch render rate.
+	if (selectedItem->getName() == "Full Rate")
+	{
+		RayRenderRate = TerrainDistanceRaymarch::RATE_FULL;
+	}
+	if (selectedItem->getName() == "Checkerboard")
+	{
+		RayRenderRate = TerrainDistanceRaymarch::RATE_CHECKERBOARD;
+	}
+	if (selectedItem->getName() == "Foveated")
+	{
+		RayRenderRate = TerrainDistanceRaymarch::RATE_FOVEATED;
+	}
 
-		theTerrain->csgOperations = csgOperations;
+	if (selectedItem->getName() == "Grid-Based Naive Marching Cubes" && currentTerrainType != TERRAIN_TYPE::TERRAIN_GRID_MC)
+	{
+		// Switch over to the grid terrain. It's already built, and already has the current CSG operations.
+		theTerrain = gridTerrain;
+		currentTerrainType = TERRAIN_TYPE::TERRAIN_GRID_MC;
 
-		GuiNeedsRebuilt = true;
+		ShowTerrainControls();
 
 		// Raise GNUPlot event
 		GNUPlotEvent newEvent;
@@ -549,15 +675,10 @@ void ofApp::onDropdownEvent(ofxDatGuiDropdownEvent e)
 	}
 	if (selectedItem->getName() == "Raymarched Distance Field" && currentTerrainType != TERRAIN_TYPE::TERRAIN_RAY_DIST)
 	{
-		theTerrain = new TerrainDistanceRaymarch();
-		((TerrainDistanceRaymarch*)theTerrain)->Rebuild(RayTerrainResolutionX, RayTerrainResolutionY);
-		((TerrainDistanceRaymarch*)theTerrain)->CurrentCamera = theCamera;
-
+		theTerrain = raymarchTerrain;
 		currentTerrainType = TERRAIN_TYPE::TERRAIN_RAY_DIST;
 
-		theTerrain->csgOperations = csgOperations;
-
-		GuiNeedsRebuilt = true;
+		ShowTerrainControls();
 
 		// Raise GNUPlot event
 		GNUPlotEvent newEvent;
@@ -582,24 +703,77 @@ void ofApp::onButtonChanged(ofxDatGuiButtonEvent e)
 {
 	if (e.target->getName() == "Rebuild Terrain" && currentTerrainType == TERRAIN_TYPE::TERRAIN_GRID_MC)
 	{
+		((TerrainGridMarchingCubes*)theTerrain)->NumLODShells = GridLODShells;
 		((TerrainGridMarchingCubes*)theTerrain)->Rebuild(GridTerrainResolution, GridTerrainResolution, GridTerrainResolution, GridTerrainSize);
 	}
 	if (e.target->getName() == "Rebuild Terrain" && currentTerrainType == TERRAIN_TYPE::TERRAIN_RAY_DIST)
 	{
 		((TerrainDistanceRaymarch*)theTerrain)->Rebuild(RayTerrainResolutionX, RayTerrainResolutionY);
 	}
+	if (e.target->getName() == "Check Density Parity" && currentTerrainType == TERRAIN_TYPE::TERRAIN_GRID_MC)
+	{
+		float maxError = ((TerrainGridMarchingCubes*)theTerrain)->CheckDensityParity();
+		std::cout << "Density parity: largest CPU/GPU difference is " << maxError << "." << std::endl;
+	}
 	if (e.target->getName() == "Smooth Normals" && currentTerrainType == TERRAIN_TYPE::TERRAIN_GRID_MC)
 	{
 		GridExpensiveNormals = e.enabled;
 	}
+	if (e.target->getName() == "Empty-Space Skipping")
+	{
+		GridEmptySpaceSkipping = e.enabled;
+	}
+	if (e.target->getName() == "Enhanced Sphere Tracing")
+	{
+		RayEnhancedSphereTracing = e.enabled;
+	}
+	if (e.target->getName() == "Cone Prepass")
+	{
+		RayConePrepass = e.enabled;
+	}
+	if (e.target->getName() == "Temporal Reprojection")
+	{
+		RayTemporalReprojection = e.enabled;
+	}
+	if (e.target->getName() == "Shadow Map")
+	{
+		RayShadowMap = e.enabled;
+	}
+	if (e.target->getName() == "Step Heatmap")
+	{
+		RayStepHeatmap = e.enabled;
+	}
 	if (e.target->getName() == "Physics Enabled")
 	{
 		PhysicsEnabled = e.enabled;
 	}
+	if (e.target->getName() == "Physics Thread")
+	{
+		// Mouse grabbing reaches into the world from the main thread, so it's only allowed while the world is stepped inline.
+		PhysicsThreaded = e.enabled;
+		if (PhysicsThreaded)
+		{
+			thePhysicsWorld->disableGrabbing();
+			physicsThread->Start();
+		}
+		else
+		{
+			physicsThread->Stop();
+			thePhysicsWorld->enableGrabbing();
+		}
+	}
 	if (e.target->getName() == "Wireframe")
 	{
 		PhysicsWireframe = e.enabled;
 	}
+	if (e.target->getName() == "Heightfield Colliders")
+	{
+		// Takes effect the next time the physics terrain is built; for the grid terrain, that's the next frame.
+		PhysicsHeightfieldColliders = e.enabled;
+		gridTerrain->HeightfieldColliders = PhysicsHeightfieldColliders;
+		gridTerrain->updatePhysicsMesh = true;
+		physicsNeedsRebuilding = true;
+	}
 	if (e.target->getName() == "Clear Logs")
 	{
 		updateStopwatch.ClearLogs();
@@ -613,6 +787,7 @@ void ofApp::onButtonChanged(ofxDatGuiButtonEvent e)
 		plotMan.WriteGraphDataFile(gnpUpdatePerformance, "update_performance.dat");
 		plotMan.WriteGraphDataFile(gnpDrawPerformance, "draw_performance.dat");
 		plotMan.WriteGraphDataFile(gnpLastFrameTime, "lastft.dat");
+		plotMan.WriteGraphDataFile(gnpPhysicsDroppedSteps, "physics_dropped_steps.dat");
 	}
 
 }
@@ -622,7 +797,6 @@ void ofApp::buildGUI()
 {
 	Stopwatch newWatch("guitime.log");
 	newWatch.StartTiming();
-	GuiNeedsRebuilt = false;
 	if (theGUI != 0)
 	{
 		delete theGUI;
@@ -660,46 +834,98 @@ void ofApp::buildGUI()
 	theGUI->addDropdown("Select Terrain Type",terrainOptions);
 	theGUI->addBreak()->setHeight(2.0f);
 
-	ofxDatGuiFolder* terrainFolder = theGUI->addFolder("Terrain Controls", ofColor::darkCyan);
-	if (currentTerrainType == TERRAIN_TYPE::TERRAIN_GRID_MC)
-	{
-		auto gridResolutionSlider = terrainFolder->addSlider("Grid Resolution", 3, 128, 64);
-		gridResolutionSlider->setPrecision(0);
-		gridResolutionSlider->bind(GridTerrainResolution);
+	// Both terrains' controls are built once; only the current terrain's are shown.
+	ofxDatGuiFolder* terrainFolder = theGUI->addFolder("Grid Terrain Controls", ofColor::darkCyan);
+	gridControls = terrainFolder;
+	auto gridResolutionSlider = terrainFolder->addSlider("Grid Resolution", 3, 128, 64);
+	gridResolutionSlider->setPrecision(0);
+	gridResolutionSlider->bind(GridTerrainResolution);
 
-	
+	auto gridShellSlider = terrainFolder->addSlider("LOD Shells", 1, TerrainGridMarchingCubes::MaxLODShells, GridLODShells);
+	gridShellSlider->setPrecision(0);
+	gridShellSlider->bind(GridLODShells);
 
-		terrainFolder->addButton("Rebuild Terrain");
-	}
-	else if (currentTerrainType == TERRAIN_TYPE::TERRAIN_RAY_DIST)
-	{
-		auto terrainResSizeX = terrainFolder->addSlider("Render Resolution X", 32, 1280, 1280);
-		terrainResSizeX->setPrecision(0);
-		terrainResSizeX->bind(RayTerrainResolutionX);
+	terrainFolder->addToggle("Empty-Space Skipping", GridEmptySpaceSkipping);
+	terrainFolder->addToggle("Smooth Normals", GridExpensiveNormals > 0);
 
-		auto terrainResSizeY = terrainFolder->addSlider("Render Resolution Y", 24, 720, 720);
-		terrainResSizeY->setPrecision(0);
-		terrainResSizeY->bind(RayTerrainResolutionY);
+	terrainFolder->addButton("Check Density Parity");
+	terrainFolder->addButton("Rebuild Terrain");
 
-		auto terrainStepAmt = terrainFolder->addSlider("Max Steps", 16, 1024, 256);
-		terrainStepAmt->setPrecision(0);
-		terrainStepAmt->bind(RayTerrainIterations);
+	terrainFolder = theGUI->addFolder("Raymarch Terrain Controls", ofColor::darkCyan);
+	raymarchControls = terrainFolder;
+	auto terrainResSizeX = terrainFolder->addSlider("Render Resolution X", 32, 1280, 1280);
+	terrainResSizeX->setPrecision(0);
+	terrainResSizeX->bind(RayTerrainResolutionX);
 
-		auto terrainDistance = terrainFolder->addSlider("Max Distance", 64, 16000, 1500);
-		terrainDistance->setPrecision(2);
-		terrainDistance->bind(RayTerrainDrawDistance);
+	auto terrainResSizeY = terrainFolder->addSlider("Render Resolution Y", 24, 720, 720);
+	terrainResSizeY->setPrecision(0);
+	terrainResSizeY->bind(RayTerrainResolutionY);
 
-		terrainFolder->addButton("Rebuild Terrain");
-	}
+	auto terrainStepAmt = terrainFolder->addSlider("Max Steps", 16, 1024, 256);
+	terrainStepAmt->setPrecision(0);
+	terrainStepAmt->bind(RayTerrainIterations);
+
+	auto terrainDistance = terrainFolder->addSlider("Max Distance", 64, 16000, 1500);
+	terrainDistance->setPrecision(2);
+	terrainDistance->bind(RayTerrainDrawDistance);
+
+	terrainFolder->addToggle("Enhanced Sphere Tracing", RayEnhancedSphereTracing);
+
+	auto terrainRelaxation = terrainFolder->addSlider("Relaxation", 1.0f, 1.99f, RayRelaxation);
+	terrainRelaxation->setPrecision(2);
+	terrainRelaxation->bind(RayRelaxation);
+
+	auto terrainLipschitz = terrainFolder->addSlider("Terrain Lipschitz", 1.0f, 4.0f, RayTerrainLipschitz);
+	terrainLipschitz->setPrecision(2);
+	terrainLipschitz->bind(RayTerrainLipschitz);
+
+	terrainFolder->addToggle("Cone Prepass", RayConePrepass);
+	terrainFolder->addToggle("Temporal Reprojection", RayTemporalReprojection);
+	terrainFolder->addToggle("Step Heatmap", RayStepHeatmap);
+
+	auto foveaSlider = terrainFolder->addSlider("Fovea Radius", 0.05f, 1.0f, RayFoveaRadius);
+	foveaSlider->setPrecision(2);
+	foveaSlider->bind(RayFoveaRadius);
+
+	auto shadowStepSlider = terrainFolder->addSlider("Shadow Steps", 0, 256, RayShadowSteps);
+	shadowStepSlider->setPrecision(0);
+	shadowStepSlider->bind(RayShadowSteps);
+
+	terrainFolder->addToggle("Shadow Map", RayShadowMap);
+
+	terrainFolder->addButton("Rebuild Terrain");
+
+	vector<string> rateOptions = { "Full Rate", "Checkerboard", "Foveated" };
+	renderRateDropdown = theGUI->addDropdown("Render Rate", rateOptions);
+	renderRateDropdown->select(RayRenderRate);
+	renderRateBreak = theGUI->addBreak();
+	renderRateBreak->setHeight(2.0f);
+
+	ShowTerrainControls();
 
 	ofxDatGuiFolder* physicsFolder = theGUI->addFolder("Physics", ofColor::red);
 
 	physicsFolder->addToggle("Physics Enabled", false);
 	physicsFolder->addToggle("Wireframe", false);
+	physicsFolder->addToggle("Heightfield Colliders", PhysicsHeightfieldColliders);
+	physicsFolder->addToggle("Physics Thread", PhysicsThreaded);
 
 	auto physicsSlider = physicsFolder->addSlider("Timescale", 0.01f, 1.0f, 1.0f);
 	physicsSlider->setPrecision(2);
 	physicsSlider->bind(PhysicsTimescale);
+
+	auto fixedStepSlider = physicsFolder->addSlider("Fixed Step (ms)", 4.0f, 33.0f, PhysicsFixedStep);
+	fixedStepSlider->setPrecision(1);
+	fixedStepSlider->bind(PhysicsFixedStep);
+
+	auto subStepSlider = physicsFolder->addSlider("Max Substeps", 1, 10, PhysicsMaxSubSteps);
+	subStepSlider->setPrecision(0);
+	subStepSlider->bind(PhysicsMaxSubSteps);
+
+	vector<string> colliderOptions = { "Density Field Contacts", "On-Demand Triangles", "Grid Colliders" };
+	auto colliderDropdown = theGUI->addDropdown("Terrain Collider", colliderOptions);
+	colliderDropdown->select(PhysicsTerrainCollider);
+	theGUI->addBreak()->setHeight(2.0f);
 	
 	auto clearButton = theGUI->addButton("Clear Logs");
 
@@ -713,6 +939,17 @@ void ofApp::buildGUI()
 	newWatch.StopTiming("GUI Updated.");
 }
 
+// Shows the controls for the current terrain, and hides the other's.
+void ofApp::ShowTerrainControls()
+{
+	bool raymarching = (currentTerrainType == TERRAIN_TYPE::TERRAIN_RAY_DIST);
+
+	gridControls->setVisible(!raymarching);
+	raymarchControls->setVisible(raymarching);
+	renderRateDropdown->setVisible(raymarching);
+	renderRateBreak->setVisible(raymarching);
+}
+
 ofxBulletTriMeshShape* ofApp::CreatePhysicsMesh(ofxBulletWorldRigid* world, ofMesh* theMesh)
 {
 	Stopwatch newWatch("physicsmesh.log");
@@ -727,75 +964,36 @@ ofxBulletTriMeshShape* ofApp::CreatePhysicsMesh(ofxBulletWorldRigid* world, ofMe
 	return newShape;
 }
 
-void ofApp::CheckBodiesAtRest()
+void ofApp::BodyFellAsleep(const btRigidBody* body)
 {
-	// Loop through list and find physics objects that are considered "at rest".
 	for (auto iter = cutPhysicsObjects.begin(); iter != cutPhysicsObjects.end(); ++iter)
 	{
-
-
-
-		if (iter->second->getRigidBody()->getLinearVelocity().length2() < 0.8 && iter->second->getRigidBody()->getAngularVelocity().length2() < 1.0)
+		if (iter->second->getRigidBody() != body)
 		{
-			// Object is asleep; convert it to a density object and remove it from the simulation.
-			ConvertMeshToDensity(iter->first, ofVec3f(iter->second->getPosition().x, iter->second->getPosition().y, iter->second->getPosition().z));
-
-			// Remove from simulation
-			iter->second->remove();
-
-			// Kill mesh
-			//delete iter->first;
-
-			// Erase from list.
-			iter = cutPhysicsObjects.erase(iter);
-			if (iter == cutPhysicsObjects.end())
-			{
-				break;
-			}
+			continue;
 		}
-	}
-
-	
-
-}
 
-void ofApp::ConvertMeshToDensity(ofMesh* theMesh, ofVec3f position)
-{
-	// NOTE: Due to time constraints, this function does not use a scan algorithm to recreate the mesh in density-field form properly.
-	// Ordinarily this function would render the mesh in its own projection space and use a raytrace-type shader to fill a 3d texture with
-	// density information. This would give us a texture that we could pass into the terrain renderers to recreate the shape exactly.
-	// However, the project has run into time constraint problems, and so instead the function simply adds a sphere to the terrain
-	// where the mesh is located, at a radius consistent with the maximal size of the object.
-
-	// Get Max, Min vertices for sizing
-	ofVec3f minVert, maxVert;
-	minVert.set(0, 0, 0);
-	maxVert.set(0, 0, 0);
-	for (auto iter = theMesh->getVertices().begin(); iter != theMesh->getVertices().end(); ++iter)
-	{
-		if (iter->x < minVert.x && iter->y < minVert.y && iter->z < minVert.z)
-		{
-			minVert.set(iter->x, iter->y, iter->z);
-		}
-		if (iter->x > maxVert.x && iter->y > maxVert.y && iter->z > maxVert.z)
+		// Go by the last snapshot, rather than reading the body while it's being stepped.
+		const PhysicsThread::BodyState* state = physicsThread->GetBodyState(body);
+		if (state == 0)
 		{
-			maxVert.set(iter->x, iter->y, iter->z);
+			return;
 		}
-	}
 
-	float radius = (maxVert - minVert).length() / 2.0f;
+		// Object is asleep; queue it to become a density object, and remove it from the simulation.
+		const btVector3& position = state->Current.getOrigin();
+		debrisConsolidator.Add(iter->first, ofVec3f(position.x(), position.y(), position.z()));
 
-	CSGAddSphere(position, radius);
+		ofxBulletCustomShape* shape = iter->second;
+		physicsThread->Enqueue([shape]()
+		{
+			shape->remove();
+			delete shape;
+		});
 
-	// Raise GNUPlot event
-	GNUPlotEvent newEvent;
-	newEvent.xPosition = gnpUpdatePerformance.Column1.size();
-	newEvent.xRange = 5;
-	newEvent.boxColour = "ccffcc";
-	newEvent.labelName = "Mesh->Density";
-	gnpUpdatePerformance.Events.push_back(newEvent);
-	gnpDrawPerformance.Events.push_back(newEvent);
-	gnpLastFrameTime.Events.push_back(newEvent);
+		cutPhysicsObjects.erase(iter);
+		return;
+	}
 }
 
 // CSG Operations work by filling a texture buffer.
@@ -803,9 +1001,10 @@ void ofApp::ConvertMeshToDensity(ofMesh* theMesh, ofVec3f position)
 // First element: Add/Subtract operation, 0 or 1
 // Second: Shape to be defined. 0: Sphere, 1: Box,
 // For spheres, the next 4 elements define the position & radius of the sphere.
-// The remaining two are left blank
+// Seventh: Lipschitz bound of the shape's distance function, used by enhanced sphere tracing. 0 means an exact distance, with a bound of 1.
+// The last is left blank
 
-void ofApp::CSGAddSphere(ofVec3f Position, float Radius)
+void ofApp::CSGAddSphere(ofVec3f Position, float Radius, bool sync)
 {
 	csgOperations.push_back(0);
 	csgOperations.push_back(0);
@@ -816,11 +1015,10 @@ void ofApp::CSGAddSphere(ofVec3f Position, float Radius)
 	csgOperations.push_back(0);
 	csgOperations.push_back(0);
 
-
-	// keep terrain parity
-	if (theTerrain)
+	// Batches of spheres are synced once, by the caller, after the last.
+	if (sync)
 	{
-		theTerrain->csgOperations = csgOperations;
+		SyncCSGOperations();
 	}
 }
 
@@ -835,11 +1033,7 @@ void ofApp::CSGRemoveSphere(ofVec3f Position, float Radius)
 	csgOperations.push_back(0);
 	csgOperations.push_back(0);
 
-	// keep terrain parity
-	if (theTerrain)
-	{
-		theTerrain->csgOperations = csgOperations;
-	}
+	SyncCSGOperations();
 }
 
 void ofApp::CSGUndo()
@@ -850,12 +1044,36 @@ void ofApp::CSGUndo()
 		csgOperations.pop_back();
 	}
 
+	SyncCSGOperations();
+
+}
+
+// Hands the current CSG operations to both terrains. They share one GPU table, so it's only uploaded once.
+void ofApp::SyncCSGOperations()
+{
+	csgRevision++;
+
 	// keep terrain parity
-	if (theTerrain)
+	if (gridTerrain)
+	{
+		gridTerrain->SetCSGOperations(csgOperations, csgRevision);
+	}
+	if (raymarchTerrain)
 	{
-		theTerrain->csgOperations = csgOperations;
+		raymarchTerrain->SetCSGOperations(csgOperations, csgRevision);
 	}
 
+	// The density field colliders read their own copy, which is swapped over between steps.
+	if (physicsThread)
+	{
+		std::vector<GLfloat> operations = csgOperations;
+		int revision = csgRevision;
+		physicsThread->Enqueue([this, operations, revision]()
+		{
+			physicsCsgOperations = operations;
+			physicsCsgRevision = revision;
+		});
+	}
 }
 
 void ofApp::exit()
@@ -865,6 +1083,54 @@ void ofApp::exit()
 	plotMan.WriteGraphDataFile(gnpUpdatePerformance, "update_performance.dat");
 	plotMan.WriteGraphDataFile(gnpDrawPerformance, "draw_performance.dat");
 	plotMan.WriteGraphDataFile(gnpLastFrameTime, "lastft.dat");
-	
+	plotMan.WriteGraphDataFile(gnpPhysicsDroppedSteps, "physics_dropped_steps.dat");
+
+	// Release the shared shader programs while the GL context is still around.
+	ShaderCache::Clear();
+
+	// Stop stepping before taking anything out of the world.
+	physicsThread->Stop();
+
+	// The density field colliders aren't ofxBullet shapes, so they have to be taken out of the world by hand.
+	thePhysicsWorld->world->removeRigidBody(terrainFieldBody);
+	delete terrainFieldBody;
+	delete terrainFieldShape;
+	thePhysicsWorld->world->removeRigidBody(terrainMeshBody);
+	delete terrainMeshBody;
+	delete terrainMeshShape;
+
+	delete physicsThread;
+}
+
+// Switches what physics objects collide with, taking the other colliders out of the world.
+void ofApp::SetTerrainCollider(TERRAIN_COLLIDER collider)
+{
+	PhysicsTerrainCollider = collider;
+	gridTerrain->BuildPhysicsMesh = (collider == COLLIDER_GRID);
+
+	std::lock_guard<std::mutex> worldLock(physicsThread->WorldMutex());
 
-}
\ No newline at end of file
+	thePhysicsWorld->world->removeRigidBody(terrainFieldBody);
+	thePhysicsWorld->world->removeRigidBody(terrainMeshBody);
+
+	if (collider == COLLIDER_GRID)
+	{
+		// Build colliders around the camera again, as soon as possible.
+		gridTerrain->updatePhysicsMesh = true;
+		physicsNeedsRebuilding = true;
+		return;
+	}
+
+	// The built colliders would only get in the way.
+	thePhysicsMesh->remove();
+	gridTerrain->ClearHeightfieldTiles();
+
+	if (collider == COLLIDER_FIELD_CONTACTS)
+	{
+		thePhysicsWorld->world->addRigidBody(terrainFieldBody);
+	}
+	else
+	{
+		thePhysicsWorld->world->addRigidBody(terrainMeshBody);
+	}
+}
@@ -14,6 +14,10 @@
 #include "Terrain.h"
 #include "TerrainGridMarchingCubes.h"
 #include "TerrainDistanceRaymarch.h"
+#include "DensityFieldCollision.h"
+#include "DensityFieldMeshShape.h"
+#include "PhysicsThread.h"
+#include "DebrisConsolidation.h"
 #include "ofxBullet.h"
 #include "ofxDatGui.h"
 #include "ofxVoro.h"
@@ -27,6 +31,9 @@ class ofApp : public ofBaseApp{
 
 		enum TERRAIN_TYPE{ TERRAIN_GRID_MC, TERRAIN_RAY_DIST };
 
+		// What physics objects collide with: the density field itself, triangles polygonised from it around each object, or colliders built by the grid terrain.
+		enum TERRAIN_COLLIDER{ COLLIDER_FIELD_CONTACTS, COLLIDER_FIELD_TRIANGLES, COLLIDER_GRID };
+
 		// openFrameworks Template Stuff
 		void setup();
 		void update();
@@ -47,6 +54,7 @@ class ofApp : public ofBaseApp{
 		
 		void gotMessage(ofMessage msg);
 		void buildGUI();
+		void ShowTerrainControls();
 
 		// Gui event handlers
 		void onDropdownEvent(ofxDatGuiDropdownEvent e);
@@ -65,6 +73,10 @@ class ofApp : public ofBaseApp{
 		Terrain* theTerrain;
 		TERRAIN_TYPE currentTerrainType;
 
+		// Both terrains are kept resident; theTerrain points at whichever is in use. The grid terrain also provides the physics mesh while raymarching.
+		TerrainGridMarchingCubes* gridTerrain = 0;
+		TerrainDistanceRaymarch* raymarchTerrain = 0;
+
 		// Lighting shader
 		ofShader* lightShader;
 
@@ -79,14 +91,31 @@ class ofApp : public ofBaseApp{
 		// Physics Stuff - Built from Vertices from the GPU.
 		ofxBulletTriMeshShape* CreatePhysicsMesh(ofxBulletWorldRigid* world, ofMesh* theMesh);
 
-		void CheckBodiesAtRest();
-		void ConvertMeshToDensity(ofMesh * theMesh, ofVec3f position);
+		// Takes a fragment Bullet has put to sleep out of the world, and queues it to become terrain.
+		void BodyFellAsleep(const btRigidBody* body);
+
+		// Settled fragments, on their way back into the terrain.
+		DebrisConsolidator debrisConsolidator;
+
+		// Switches what physics objects collide with, taking the other colliders out of the world.
+		void SetTerrainCollider(TERRAIN_COLLIDER collider);
 		
 		
 		// Physics objects
 		ofxBulletWorldRigid* thePhysicsWorld;
 		ofxBulletTriMeshShape* thePhysicsMesh;
 
+		// Steps the world on a thread of its own. Anything that changes the world from here on should go through it.
+		PhysicsThread* physicsThread = 0;
+
+		// The terrain's density field, as a collider in its own right.
+		DensityFieldShape* terrainFieldShape;
+		btRigidBody* terrainFieldBody;
+
+		// The terrain's density field, polygonised on demand wherever there's something to collide with it.
+		DensityFieldMeshShape* terrainMeshShape;
+		btRigidBody* terrainMeshBody;
+
 		// These lists are for user-interaction; when carving out terrain, one could produce a physics object sphere & shatter it if the shift key is held.
 		std::vector<ofxBulletSphere*> createdTerrainSpheres;
 
@@ -98,31 +127,64 @@ class ofApp : public ofBaseApp{
 		ofxDatGui* theGUI;
 		bool ShiftHeld;
 		bool CtrlHeld;
-		bool GuiNeedsRebuilt;
+		ofxDatGuiFolder* gridControls;
+		ofxDatGuiFolder* raymarchControls;
+		ofxDatGuiDropdown* renderRateDropdown;
+		ofxDatGuiBreak* renderRateBreak;
 
 		// Terrain stuff
 
 		int GridTerrainResolution = 32;
 		float GridTerrainSize = 5;
 		float GridExpensiveNormals = 0;
+		bool GridEmptySpaceSkipping = true;
+		int GridLODShells = 1;
 
 		float RayTerrainResolutionX = 1280;
 		float RayTerrainResolutionY = 720;
 		float RayTerrainDrawDistance = 1500.0f;
 		int RayTerrainIterations = 256;
+		bool RayEnhancedSphereTracing = true;
+		float RayRelaxation = 1.6f;
+		float RayTerrainLipschitz = DensityField::TerrainLipschitz;
+		bool RayStepHeatmap = false;
+		bool RayConePrepass = true;
+		bool RayTemporalReprojection = true;
+		TerrainDistanceRaymarch::RENDER_RATE RayRenderRate = TerrainDistanceRaymarch::RATE_FULL;
+		float RayFoveaRadius = 0.35f;
+		int RayShadowSteps = 64;
+		bool RayShadowMap = false;
 
 		// Physics stuff
 
 		bool PhysicsEnabled = false;
 		float PhysicsTimescale = 1.0f;
 		bool PhysicsWireframe = false;
+		bool PhysicsHeightfieldColliders = true;
+		TERRAIN_COLLIDER PhysicsTerrainCollider = COLLIDER_FIELD_CONTACTS;
+
+		// Whether the world is stepped on its own thread, or inline in update.
+		bool PhysicsThreaded = true;
+
+		// Length of a physics step, in milliseconds of simulated time, and the most steps taken at once before time is dropped.
+		float PhysicsFixedStep = 1000.0f / 60.0f;
+		int PhysicsMaxSubSteps = 5;
+
+		// The physics thread's dropped step count as of the last frame, so each frame's share can be graphed.
+		int lastDroppedSteps = 0;
 
 		// Terrain modification buffer
 		// Operations to change terrain via Constructive Solid Geometry (adding/removing regions of terrain via primitives)
 		// Buffer will have a line of 8 floats: type, x, y, z - then remaining 4 are optionals - bounding, radius etc
 		
 		std::vector<GLfloat> csgOperations;
-		void CSGAddSphere(ofVec3f Position, float Radius);
+		int csgRevision = 0;
+
+		// The physics thread's copy of the CSG operations, which the density field colliders read. It's only ever changed by commands on that thread.
+		std::vector<GLfloat> physicsCsgOperations;
+		int physicsCsgRevision = 0;
+		void SyncCSGOperations();
+		void CSGAddSphere(ofVec3f Position, float Radius, bool sync = true);
 		void CSGRemoveSphere(ofVec3f Position, float Radius);
 		void CSGUndo();
 
@@ -149,4 +211,5 @@ class ofApp : public ofBaseApp{
 		GNUPlotData<int> gnpDrawPerformance;
 		GNUPlotData<int> gnpUpdatePerformance;
 		GNUPlotData<float> gnpLastFrameTime;
+		GNUPlotData<int> gnpPhysicsDroppedSteps;
 };